@@ -7,6 +7,20 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <limits.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <errno.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <malloc.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <regex.h>
 // https://stackoverflow.com/questions/1644868/define-macro-for-log-printing-in-c
 // EDIT: https://stackoverflow.com/questions/1941307/log-print-macro-in-c
 #ifdef DEBUG
@@ -17,6 +31,10 @@
 
 #define SCREEN_WIDTH   1280
 #define SCREEN_HEIGHT  720
+#define MAX_OPEN_JOBS  8      // launchers that may run at once
+#define LATENCY_SAMPLES 256   // input latencies kept for the statistics overlay
+#define HINT_BUFFER_MAX_SIZE 3  // keys in a hint label, each node has room for one
+#define NODE_INLINE_TEXT 24     // texts shorter than this are stored in the node itself
 
 
 /* User Customizable Variables*/
@@ -25,6 +43,9 @@ static const SDL_Color HINT_COLOR =       {220, 0, 0};
 static const SDL_Color SELECTED_COLOR =   {0, 220, 0};
 static const SDL_Color UNSELECTED_COLOR = {0, 55, 0};
 static const SDL_Color CUT_COLOR =        {0, 0, 220};
+static const SDL_Color COPY_COLOR =       {0, 220, 220};
+static const SDL_Color MARKED_COLOR =     {220, 0, 220};
+static const SDL_Color SEARCH_COLOR =     {220, 220, 0};
 static const SDL_Color EDGE_COLOR =       {220, 220, 220};
 static const SDL_Color BACKGROUND_COLOR = {15, 15, 15};
 static int TEXTBOX_WIDTH_SCALE = 25;                        // width of char
@@ -33,15 +54,29 @@ static double UI_SCALE = 1.0;
 static double GRAPH_SCALE = 1.0;
 static const double ZOOM_SPEED = 1.1; // rate at which graph zooms out, > 1
 static const int FILENAME_BUFFER_MAX_SIZE = 64;
-static const int HINT_BUFFER_MAX_SIZE = 3;
+static const int SEARCH_BUFFER_MAX_SIZE = 64;
+static const int SEARCH_MAX_RESULTS = 20;                   // must fit in two-char hint labels
 static const int MAX_TEXT_LEN = 128;                              // Max Num of chars in a node
 static int NUM_CHARS_B4_WRAP = 20;
+static const int MAX_NODE_LINES = 8;                        // lines of text a node shows, longer text scrolls in Edit mode
 // radius and thickness of node box
 static const int RADIUS = 50;
 static const int THICKNESS = 5;
 static int FONT_SIZE = 40;
 static const char* FONT_NAME = "./assets/SourceCodePro-Regular.otf";   // Default Font name
 static const char* HINT_CHARS = "adfghjkl;\0";              // characters to use for hints
+static size_t UNDO_MEMORY_BUDGET = 64 * 1024 * 1024;        // bytes kept for undo history
+static const int JOURNAL_COMPACT_RECORDS = 4096;            // journal records between compactions
+static const int LAZY_LOAD_BUDGET = 2000;                   // nodes parsed per expansion in lazy mode
+static const size_t LAYOUT_CACHE_MIN_NODES = 50000;         // smaller trees are laid out on startup instead
+static const size_t LAYOUT_ASYNC_MIN_NODES = 50000;         // smaller trees are laid out between events instead
+static const int RELOAD_MATCH_WINDOW = 16;                  // siblings looked ahead when matching a changed file
+static const int EXPORT_TILE_WIDTH = 4096;                  // offscreen tile used by export; short tiles keep
+static const int EXPORT_TILE_HEIGHT = 64;                   // the strip staged on disk small
+static const int MINIMAP_WIDTH = 240;                       // size of the overview pane toggled with n
+static const int MINIMAP_HEIGHT = 160;
+static const Uint32 OPEN_STATUS_MS = 3000;                  // how long a finished open stays on screen
+static const Uint32 OPEN_POLL_MS = 100;                     // event wait timeout while opens are shown
 
 
 // ENUMS AND DATA STRUCTURES
@@ -51,8 +86,13 @@ typedef struct Buffer Buffer;
 typedef struct Array Array;
 typedef struct Node Node;
 typedef struct Graph Graph;
+typedef struct Loader Loader;
+typedef struct Saver Saver;
+typedef struct Query Query;
 
-enum Mode{Travel, Edit, FilenameEdit, Delete, Cut, Paste, MakeChild};
+enum OutlineFormat{Native, Opml, Json};
+enum MemTag{MemNodes, MemChildren, MemText, MemHints, MemLines, MemSearch, MemUndo, MemFiles, MemOther, MEM_TAGS};
+enum Mode{Travel, Edit, FilenameEdit, Delete, Cut, Copy, Paste, MakeChild, Select, Search, SearchJump, Conflict};
 char* getModeName(enum Mode mode_param){
     switch(mode_param) {
         case Edit: return "EDIT";
@@ -60,20 +100,25 @@ char* getModeName(enum Mode mode_param){
         case Delete: return "DELETE";
         case FilenameEdit: return "FILENAME EDIT";
         case Cut: return "CUT";
+        case Copy: return "COPY";
         case Paste: return "PASTE";
         case MakeChild: return "MAKE CHILD";
+        case Select: return "SELECT";
+        case Search: return "SEARCH";
+        case SearchJump: return "SEARCH JUMP";
+        case Conflict: return "CONFLICT";
         default: return NULL;
     }
 }
 bool isHintMode(enum Mode mode_param){
     switch(mode_param){
-        case Travel: case Delete: case Cut: case Paste: case MakeChild: return true;
+        case Travel: case Delete: case Cut: case Copy: case Paste: case MakeChild: case Select: case SearchJump: return true;
         default: return false;
     }
 }
 bool isEditMode(enum Mode mode_param){
     switch(mode_param){
-        case FilenameEdit: case Edit: return true;
+        case FilenameEdit: case Edit: case Search: return true;
         default: return false;
     }
 }
@@ -102,51 +147,137 @@ void clearBuffer(Buffer* buffer){
     buffer->len = 0;
 }
 
+/* Every heap allocation is counted against the subsystem that owns it, by
+ * the size the allocator actually reserved for it, so the figures add up to
+ * what the heap holds rather than what was asked for. */
+typedef struct MemStats MemStats;
+struct MemStats {
+    size_t live_bytes, peak_bytes;
+    size_t live_count, peak_count;
+    size_t allocs;      // allocations ever made, to spot churn
+};
+
+static MemStats MEM_STATS[MEM_TAGS];
+static SDL_SpinLock MEM_LOCK = 0;  // journal compaction frees from its own thread
+static char* MEM_TAG_NAMES[MEM_TAGS] = {"nodes", "child arrays", "node text", "hint arrays",
+                                        "getLines", "search", "undo", "file i/o", "other"};
+
+// adds (sign 1) or removes (sign -1) an allocation made elsewhere, e.g. by open_memstream
+void memCount(enum MemTag tag, void* ptr, int sign){
+    if ( !ptr ) return;
+    MemStats* stats = &MEM_STATS[tag];
+    size_t bytes = malloc_usable_size(ptr);
+    SDL_AtomicLock(&MEM_LOCK);
+    if ( sign > 0 ){
+        stats->live_bytes += bytes;
+        stats->live_count++;
+        stats->allocs++;
+        if ( stats->live_bytes > stats->peak_bytes ) stats->peak_bytes = stats->live_bytes;
+        if ( stats->live_count > stats->peak_count ) stats->peak_count = stats->live_count;
+    }
+    else {
+        stats->live_bytes -= bytes;
+        stats->live_count--;
+    }
+    SDL_AtomicUnlock(&MEM_LOCK);
+}
+
+void* memCalloc(enum MemTag tag, size_t num, size_t size){
+    void* ptr = calloc(num, size);
+    memCount(tag, ptr, 1);
+    return ptr;
+}
+
+void* memMalloc(enum MemTag tag, size_t size){
+    void* ptr = malloc(size);
+    memCount(tag, ptr, 1);
+    return ptr;
+}
+
+void* memRealloc(enum MemTag tag, void* ptr, size_t size){
+    memCount(tag, ptr, -1);
+    ptr = realloc(ptr, size);
+    memCount(tag, ptr, 1);
+    return ptr;
+}
+
+char* memStrdup(enum MemTag tag, char* string){
+    char* copy = strdup(string);
+    memCount(tag, copy, 1);
+    return copy;
+}
+
+void memFree(enum MemTag tag, void* ptr){
+    memCount(tag, ptr, -1);
+    free(ptr);
+}
+
 /* dynamic array to save me some headache, code is stolen from stack overflow */
 struct Array {
     Node **array;
     size_t num;  /* number of children in array */
     size_t size; /* max size of array */
+    enum MemTag tag; /* subsystem the array is counted against */
+    size_t indexed; /* child arrays: entries below this know their position, see childIndex */
 };
-Array* initArray(size_t initial_size) {
+Array* initTaggedArray(size_t initial_size, enum MemTag tag) {
     Array *a;
-    a = calloc(1, sizeof(Array));
-    a->array = calloc(initial_size, sizeof(void*));
+    a = memCalloc(tag, 1, sizeof(Array));
+    a->array = memCalloc(tag, initial_size, sizeof(void*));
     a->num = 0;
     a->size = initial_size;
+    a->tag = tag;
+    a->indexed = 0;
     return a;
 }
+Array* initArray(size_t initial_size) {
+    return initTaggedArray(initial_size, MemOther);
+}
 void insertArray(Array *a, void* element) {
     // a->num is the number of used entries, because a->array[a->num++] updates a->num only *after* the array has been accessed.
     // Therefore a->num can go up to a->size
     if (a->num == a->size) {
         a->size *= 2;
         logPrint("Reallocing, num %ld size %ld...\n", a->num, a->size);
-        a->array = realloc(a->array, a->size * sizeof(void*));
+        a->array = memRealloc(a->tag, a->array, a->size * sizeof(void*));
         logPrint("Realloced.\n");
     }
     a->array[a->num++] = element;
 }
+// returns the position of node in the array, or -1
+int indexInArray(Array *a, Node* node){
+    for (int i = 0; i < a->num; ++i)
+        if ( a->array[i] == node )
+            return i;
+    return -1;
+}
+
+// removes the element at position index, keeping the order of the others
+void removeArrayAt(Array *a, int index){
+    memmove(a->array + index, a->array + index + 1, (a->num - index - 1) * sizeof(void*));
+    a->num -= 1;
+}
+
 void removeFromArray(Array *a, Node* node){
-    bool start_shifting = false;
-    Node** nodes = a->array;
-    for (int i = 0; i < a->num; ++i) {
-        if ( nodes[i] == node )
-            start_shifting = true;
-        if ( start_shifting )
-            nodes[i] = nodes[i+1];
-    }
-    if (a->num > 0 && start_shifting){
-        a->array[a->num] = NULL;
-        a->num -= 1;
-    }
+    int index = indexInArray(a, node);
+    if ( index >= 0 )
+        removeArrayAt(a, index);
+}
+
+// inserts element before position index, appends if index is out of range
+void insertArrayAt(Array *a, void* element, int index){
+    insertArray(a, element);
+    if ( index < 0 || index >= a->num - 1 )
+        return;
+    memmove(a->array + index + 1, a->array + index, (a->num - 1 - index) * sizeof(void*));
+    a->array[index] = element;
 }
 
 void* freeArray(Array *a) {
-    free(a->array);
+    memFree(a->tag, a->array);
     a->array = NULL;
     a->num = a->size = 0;
-    free(a);
+    memFree(a->tag, a);
     return NULL;
 }
 
@@ -158,63 +289,207 @@ struct Node {
     int rightmost; /* greatest descendant accumulated x_off wrt node*/
     int leftmost; /* smallest (negative) acc. x_off wrt node */
     Buffer text;
-    char* hint_text;
+    char text_inline[NODE_INLINE_TEXT]; /* holds short texts, see nodeTextStore */
+    char hint_text[HINT_BUFFER_MAX_SIZE + 1];
+    int hint_label; /* index of the label in the hint pool, -1 if none, see HINT MANAGEMENT */
+    unsigned int hint_stamp; /* equals HINT_STAMP while the node is a hint target */
+    unsigned int search_id; /* slot in the search index, 0 if never indexed */
+    unsigned int search_mark; /* equals SEARCH_STAMP while the node is a search result */
+    bool search_dirty; /* text changed since it was last indexed */
+    bool marked; /* part of the selection made in Select mode, see MARKED */
+    int index; /* position among the parent's children, see childIndex */
+    long long lazy_next; /* lazy index line of the next child to load, -1 once all children are loaded */
+    long long lazy_end; /* last line of the node's subtree in the lazy index */
+    size_t size; /* nodes in the subtree, the node included, see aggregateAttach */
+    size_t leaves; /* leaves of the subtree */
+    int height; /* levels of the subtree below the node, 0 for a leaf */
+    int tallest; /* children whose subtree is height - 1 levels deep */
 };
 /* creates a new node at the origin */
 Node* makeNode(){
-    Node* node = malloc(sizeof(Node));
-    node->children = initArray(5);
+    Node* node = memCalloc(MemNodes, 1, sizeof(Node));
+    node->children = initTaggedArray(5, MemChildren);
     node->children->num = 0;
     node->pos.x = 0;
     node->pos.y = 0;
-    node->text.buf = calloc(MAX_TEXT_LEN, sizeof(char));
-    node->text.size = MAX_TEXT_LEN;
+    node->text.buf = node->text_inline;
+    node->text.size = 0;   // read-only until the node is edited, see nodeTextUnshare
     node->text.len = 0;
-    node->hint_text = calloc(HINT_BUFFER_MAX_SIZE, sizeof(char));
+    node->hint_label = -1;
+    node->search_id = 0;
+    node->search_mark = 0;
+    node->search_dirty = false;
+    node->lazy_next = -1;
+    node->lazy_end = -1;
+    node->size = 1;
+    node->leaves = 1;
+    node->height = 0;
+    node->tallest = 0;
     return node;
 }
+
+/* Every node remembers its position among its siblings, so that a node with tens of
+ * thousands of children is not scanned to find one of them. Inserting or removing a
+ * child only moves the pointers after it, and the positions from there on are renumbered
+ * by childIndex when they are next asked for, up to the child asked for. */
+int childIndex(Node* node){
+    Array* siblings = node->p->children;
+    if ( node->index < siblings->indexed && siblings->array[node->index] == node )
+        return node->index;
+    for (size_t i = siblings->indexed; i < siblings->num; i++) {
+        siblings->array[i]->index = i;
+        siblings->indexed = i + 1;
+        if ( siblings->array[i] == node )
+            return i;
+    }
+    return -1;
+}
+
+// inserts a node before position index of the parent's children, appends it if index is out of range
+void insertChild(Node* parent, Node* node, int index){
+    Array* children = parent->children;
+    if ( index < 0 || index > children->num )
+        index = children->num;
+    insertArrayAt(children, node, index);
+    node->index = index;
+    if ( children->indexed >= index )
+        children->indexed = index + 1;
+}
+
+// removes a node from its parent's children, returns its former index or -1
+int removeChild(Node* node){
+    Array* siblings = node->p->children;
+    int index = childIndex(node);
+    if ( index < 0 )
+        return -1;
+    removeArrayAt(siblings, index);
+    if ( siblings->indexed > index )
+        siblings->indexed = index;
+    return index;
+}
+
+void layoutInvalidate();
+void aggregateAttach(Node* node);
 Node* makeChild(Node* parent){
     Node* child = makeNode();
     child->p = parent;
-    insertArray(parent->children, child);
+    insertChild(parent, child, -1);
+    aggregateAttach(child);
+    layoutInvalidate();
     return child;
 }
+
+/* Depth first walk over a subtree with an explicit stack, so that trees of any depth can be
+ * traversed. walkNext returns each node twice: on the way down, before its children
+ * (walk.pre is true), and on the way up, after all of them (walk.pre is false). walk.level
+ * is the depth of the returned node below the root of the walk. Children are visited left
+ * to right, or right to left when walk.reverse is set. Nodes deeper than walk.max_level are
+ * skipped, unless it is -1. The tree may not change during a walk, except that a node may be
+ * freed on the way up. */
+typedef struct WalkFrame WalkFrame;
+struct WalkFrame {
+    Node* node;
+    int child;  /* next child to descend into, -1 before the node has been returned */
+};
+
+typedef struct Walk Walk;
+struct Walk {
+    WalkFrame* stack;
+    int top;
+    int size;
+    int level;
+    int max_level;
+    bool pre;
+    bool reverse;
+};
+
+void walkBegin(Walk* walk, Node* root){
+    walk->size = 64;
+    walk->stack = memMalloc(MemOther, walk->size * sizeof(WalkFrame));
+    walk->stack[0] = (WalkFrame) {root, -1};
+    walk->top = root ? 0 : -1;
+    walk->level = 0;
+    walk->max_level = -1;
+    walk->pre = true;
+    walk->reverse = false;
+}
+
+Node* walkNext(Walk* walk){
+    while ( walk->top >= 0 ){
+        WalkFrame* frame = &walk->stack[walk->top];
+        Node* node = frame->node;
+        if ( frame->child < 0 ){
+            frame->child = 0;
+            walk->pre = true;
+            walk->level = walk->top;
+            return node;
+        }
+        if ( walk->top != walk->max_level && frame->child < node->children->num ){
+            int index = walk->reverse ? node->children->num - 1 - frame->child : frame->child;
+            frame->child++;
+            if ( walk->top + 1 == walk->size ){
+                walk->size *= 2;
+                walk->stack = memRealloc(MemOther, walk->stack, walk->size * sizeof(WalkFrame));
+            }
+            walk->stack[++walk->top] = (WalkFrame) {node->children->array[index], -1};
+            continue;
+        }
+        walk->pre = false;
+        walk->level = walk->top--;
+        return node;
+    }
+    return NULL;
+}
+
+void walkEnd(Walk* walk){
+    memFree(MemOther, walk->stack);
+}
+
+void searchForgetNode(Node* node);
+void nodeTextRelease(Node* node);
+void unmarkSubtree(Node* node);
 // frees all memory for the given node, as well as all its descendants
 void deleteNode(Node* node){
     logPrint("DELETEING %p\n", node);
     /* Handle nodes that have already been deleted */
     if ( node == NULL )
         return;
-    /* delete each child */
-    for (int i=0; i<node->children->num; i++)
-        deleteNode( node->children->array[i] );
-
-    /* Then delete node */
-    logPrint("Freeing children\n");
-    freeArray(node->children);
-    logPrint("Freeing buffer\n");
-    free(node->text.buf);
-    logPrint("Freeing hint_text\n");
-    free(node);
-    logPrint("Deleted node %p\n", node);
+    /* children are freed before their parent */
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); ) {
+        if ( walk.pre ) continue;
+        searchForgetNode(cur);
+        logPrint("Freeing children\n");
+        freeArray(cur->children);
+        logPrint("Freeing buffer\n");
+        nodeTextRelease(cur);
+        memFree(MemNodes, cur);
+        logPrint("Deleted node %p\n", cur);
+    }
+    walkEnd(&walk);
 }
 // removes each node in a subtree from a given Array
 void removeSubtreeFromArray(Array* array, Node* node) {
-    if(node == NULL)
+    if ( array->num == 0 )
         return;
-    removeFromArray(array, node);
-    for(int i = 0; i < node->children->num; i++)
-        removeSubtreeFromArray(array, node->children->array[i]);
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); )
+        if ( walk.pre )
+            removeFromArray(array, cur);
+    walkEnd(&walk);
 }
 bool isInSubtree(Node* node, Node* root) {
     if (node==NULL || root==NULL)
         return false;
-    if (node == root)
-        return true;
-    for (int i = 0; i < root->children->num; i++)
-        if (isInSubtree(node, root->children->array[i]))
-            return true;
-    return false;
+    bool found = false;
+    Walk walk;
+    walkBegin(&walk, root);
+    for (Node* cur; !found && (cur = walkNext(&walk)); )
+        found = cur == node;
+    walkEnd(&walk);
+    return found;
 }
 
 struct Graph {
@@ -236,38 +511,154 @@ static enum Mode MODE;          // Global mode
 static Buffer HINT_BUFFER = {NULL, 0, HINT_BUFFER_MAX_SIZE};
 // {ptr, cur_len, max_size} for fname
 static Buffer FILENAME_BUFFER = {NULL, 0, FILENAME_BUFFER_MAX_SIZE};
+// {ptr, cur_len, max_size} for the search query
+static Buffer SEARCH_BUFFER = {NULL, 0, SEARCH_BUFFER_MAX_SIZE};
 static TTF_Font* FONT;          // Global Font object
 static Array* HINT_NODES;       // array of all nodes to be hinted to
 static char** HINT_TEXT_QUEUE;
 static Buffer* CURRENT_BUFFER;  // buffer to store current hint progress
 static Node* CUT = NULL;
+static Node* COPY = NULL;       // source of the copies made in Paste mode
+static Array* MARKED;           // nodes selected in Select mode, in the order they were marked
+static bool MOVE_MARKED = false; // Paste mode moves the marked nodes rather than CUT or a copy
+static bool PASTE_AFTER = false; // Paste mode puts the subtree right after the target rather than under it
 static bool TOGGLE_MODE = false;
 static char* TOGGLE_INDICATOR = "MODE PERSIST\0";
 static Node* LEFT_NEIGHBOR = NULL; // left and right neighbors of the selected node
 static Node* RIGHT_NEIGHBOR = NULL;
 static int OFFSCREEN_PADDING = 500;
+static bool MEMORY_OVERLAY = false;
+static bool MINIMAP_SHOWN = false;
+static bool REPLAYING = false;  // a recording is being replayed, nothing is written or launched
+static Point RENDER_ORIGIN = {0, 0};   // graph coordinates of the top left of the render target
 static int CURSOR_POSITION = 0;
+static int EDIT_SCROLL = 0;     // first line shown of the node being edited, see editScroll
 static int unwritten = 0;
+static unsigned long long FILE_HASH;   // FNV-1a hash of the file as last read
+static Array* SEARCH_RESULTS;   // nodes matching SEARCH_BUFFER, in index order
+static unsigned int SEARCH_STAMP = 0; // bumped on every query, see Node.search_mark
 
 // GENERAL UTIL FUNCTIONS
+int unlinkNode(Node* node);
+int detachNode(Node* node);
+void attachNode(Node* node, Node* parent, int index);
+void moveNode(Node* node, Node* parent, int index);
+Node* copySubtree(Node* node);
+void setNodeText(Node* node, char* text);
+void loadNodeText(Node* node, char* text);
+char* nodePath(Node* node);
+size_t subtreeSize(Node* node);
+void aggregateAttach(Node* node);
+void aggregateDetach(Node* node, Node* parent);
+void aggregateSubtree(Node* node);
+unsigned long long fnv1a(unsigned long long hash, char* buf, size_t len);
 void removeNodeFromGraph(Node* node);
 int min(int a, int b);
 int max(int a, int b);
 int getWidth (char* message, bool wrap);
 int getHeight (char* message, bool wrap);
+int nodeTextHeight(char* text);
 void deleteCharInBufferRelativeToCursor(int relative_position);
+// STRING INTERNING
+char* internString(char* text, size_t len);
+char* internRetain(char* text);
+void internRelease(char* text);
+bool nodeTextInline(Node* node);
+void nodeTextStore(Node* node, char* text, size_t len);
+void nodeTextUnshare(Node* node);
+void nodeTextShare(Node* node);
+void nodeTextRelease(Node* node);
 // READ/WRITE
 void replaceChar(char* arr, char find, char replace);
 unsigned int countTabs(char* string);
 void endAtNewline(char* string, int text_len);
+enum OutlineFormat outlineFormat(char* path);
+void loaderBegin(Loader* loader, Node* root, Saver* saver);
+Node* loaderAdd(Loader* loader, int level, char* text);
+void loaderSetText(Loader* loader, int level, char* text);
+void loaderEnd(Loader* loader);
+void importNative(FILE* fp, Loader* loader, long long num_lines, unsigned long long* hash);
+bool importOpml(FILE* fp, Loader* loader);
+bool importJson(FILE* fp, Loader* loader);
+bool importOutline(FILE* fp, enum OutlineFormat format, Loader* loader, unsigned long long* hash);
+void saverBegin(Saver* saver, FILE* file, enum OutlineFormat format);
+void saverNode(Saver* saver, int level, char* text);
+void saverClose(Saver* saver);
+void saverEnd(Saver* saver);
+void saveSubtree(Saver* saver, Node* node, int level);
+void saveTree(FILE* file, enum OutlineFormat format);
+bool convertOutline(char* from, char* to);
 void readFile();
+Node* readSubtree(FILE* fp, int num_lines);
 void writeChildrenStrings(FILE* file, Node* node, int level);
+void clipboardCopy(Node* node);
+Node* clipboardRead();
 void writeFile();
+// JOURNAL
+void journalCreate(Node* node);
+void journalDelete(Node* node);
+void journalMove(char* from, Node* node);
+void journalText(Node* node);
+void journalSubtree(Node* node);
+void journalLoad();
+void journalCompact(bool wait);
+void journalMaybeCompact();
+void journalSync();
+bool journalSave();
+void journalClose();
+// LAZY LOADING
+void lazyOpen();
+void lazyExpand(Node* node, int budget);
+void lazyLoadRemaining(Node* node);
+void lazyFollowSelection();
+void lazyWriteDescendants(FILE* file, Node* node, int level);
+void lazySaveDescendants(Saver* saver, Node* node, int level);
+bool lazySave();
+void lazyClose();
+// LIVE RELOAD
+void reloadWatch();
+void reloadRemember();
+void reloadApply();
+void reloadKeep();
+void reloadMaybeApply();
+void reloadClose();
 // HINT MANAGEMENT
 void calculateNeighbors(Node* root, Node* selected);
 void clearHintText();
 void populateHintNodes(Node* node);
 void populateHintText(Node* node);
+// SEARCH
+void searchIndexNode(Node* node);
+void searchMarkDirty(Node* node);
+void searchForgetNode(Node* node);
+void searchFlushDirty();
+void searchQuery(char* query);
+void searchUpdate();
+void searchClearResults();
+void searchIndexSubtree(Node* node);
+void searchForgetSubtree(Node* node);
+// UNDO
+void undoRecordCreate(Node* node);
+void undoRecordDelete(Node* node, Node* parent, int index);
+void undoRecordMove(Node* node, Node* old_parent, int old_index, Node* new_parent, int new_index);
+void undoBeginTextEdit(Node* node);
+void undoEndTextEdit();
+void undoBeginBatch();
+void undoEndBatch();
+void undo();
+void redo();
+// SELECTION
+void toggleMark(Node* node);
+void unmarkSubtree(Node* node);
+void clearMarks();
+void deleteMarked();
+void moveMarked(Node* parent);
+void makeChildOfMarked();
+// OPEN JOBS
+void openNodeText(Node* node);
+void reapOpenJobs();
+bool openJobsShown();
+void drawOpenJobs(Point pos);
 // EVENT HANDLING
 void activateHints();
 void switchMode(enum Mode to);
@@ -278,41 +669,282 @@ void doKeyDown(SDL_KeyboardEvent *event);
 void doKeyUp(SDL_KeyboardEvent *event);
 void eventHandler(SDL_Event *event);
 // POSITION CALCULATION ALGORITHM
-int getDepth(Node* node);
-void calculateOffsets(Node* node);
-void calculateMaxHeights(Node* node, int level, int* max_heights);
-void applyOffsets(Node* node, int x_offset, int level, int* y_levels);
-void centerOnSelected(Node* node, int selected_x, int selected_y);
+void offsetNode(Node* node);
+int* calculateOffsets(Node* root, int* depth);
+void applyOffsets(Node* root, Node* selected, int* y_levels);
 void calculatePositions(Node* root, Node* selected);
+void layoutInvalidate();
+void layoutSync(Node* root);
+void layoutAsyncBegin();
+bool layoutReceive(SDL_Event* event);
+bool layoutCacheLoad();
+void layoutCacheSave();
+void layoutClose();
 void recursivelyPrintPositions(Node* node, int level);
 // RENDERING
 void renderMessage(char* message, Point pos, double scale, SDL_Color color, bool wrap, bool cursor);
+void renderLines(char* message, Point pos, double scale, SDL_Color color, bool wrap, bool cursor, int first, int count);
 void drawBox(SDL_Renderer *surface, int n_cx, int n_cy, int len, int height, int offset, const SDL_Color color);
 void drawBorder(SDL_Renderer *surface, int n_cx, int n_cy, int len, int height, int thickness, const SDL_Color color);
+SDL_Color nodeBorderColor(Node* node);
+void drawNodeItem(Node* node, bool hints);
 void drawNode(Node* node);
 char** getLines(char* message, int wrap);
 void freeLines(char** lines);
 char* getEndOfLine(char* line_start, int wrap);
 void prepareScene();
 void presentScene();
+// MINIMAP
+void minimapInvalidate();
+void minimapReset();
+void drawMinimap();
+bool minimapClick(int x, int y);
+// INPUT LATENCY
+void latencyInput(SDL_Event* event);
+void latencyPresented();
+void latencyReport(FILE* file);
+// MEMORY STATISTICS
+void memReport(FILE* file);
+void drawMemoryOverlay();
+// RECORD AND REPLAY
+bool recordBegin(char* path);
+void recordEvent(SDL_Event* event);
+void recordEnd();
+bool replayEvents(char* path);
+// EXPORT
+void exportBounds(Node* node, int* bounds);
+bool exportTree(char* path);
+void exportCurrentTree(char* extension);
+// BATCH QUERIES
+void queryNode(Query* query, int level, char* text);
+int runQuery(int argc, char** argv);
 // INIT
-void initSDL();
+void initSDL(bool headless);
+void initWindow();
 
 // GENERAL UTIL FUNCTIONS
 
-// Utility function for removing a node & subtree from graph
-void removeNodeFromGraph(Node* node){
-    if ( node == GRAPH.root ) return;
-    logPrint("Removing node from graph...\n");
-    // remove node from parent's children
-    removeFromArray(node->p->children, node);
+// Removes a node from its parent's children, returns its former index. node->p is left intact.
+int unlinkNode(Node* node){
+    int index = removeChild(node);
+    aggregateDetach(node, node->p);
+    layoutInvalidate();
+    return index;
+}
+
+// Unlinks a node & subtree and drops every global reference into it, keeping it in memory
+int detachNode(Node* node){
+    int index = unlinkNode(node);
     // remove hint memory for this node & subtree
     removeSubtreeFromArray(HINT_NODES, node);
-    // if the currently selected node would be deleted, bubble up to the parent
+    // if the currently selected node would be detached, bubble up to the parent
     if ( isInSubtree(GRAPH.selected, node) )
         GRAPH.selected = node->p;
-    // free memory for this node and its subtree
-    deleteNode(node);
+    if ( isInSubtree(CUT, node) )
+        CUT = NULL;
+    if ( isInSubtree(COPY, node) )
+        COPY = NULL;
+    if ( MARKED->num )
+        unmarkSubtree(node);
+    return index;
+}
+
+void attachNode(Node* node, Node* parent, int index){
+    lazyLoadRemaining(parent);
+    insertChild(parent, node, index);
+    node->p = parent;
+    aggregateAttach(node);
+    layoutInvalidate();
+}
+
+// Reparents a node & subtree, index -1 appends it to the new parent's children
+void moveNode(Node* node, Node* parent, int index){
+    Node* old_parent = node->p;
+    char* from = nodePath(node);
+    int old_index = unlinkNode(node);
+    attachNode(node, parent, index);
+    journalMove(from, node);
+    memFree(MemOther, from);
+    undoRecordMove(node, old_parent, old_index, parent, childIndex(node));
+}
+
+// Duplicates a node & subtree, detached. Text is shared through the intern table, and
+// children that are not loaded yet are shared through the lazy index instead of read.
+Node* copySubtree(Node* node){
+    Node* root = NULL;
+    Node* parent = NULL;  // copy of the parent of the node being copied
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); ) {
+        if ( !walk.pre ){
+            parent = parent->p;
+            continue;
+        }
+        Node* copy = makeNode();
+        if ( cur->text.size || nodeTextInline(cur) )
+            nodeTextStore(copy, cur->text.buf, cur->text.len);
+        else {
+            copy->text.buf = internRetain(cur->text.buf);
+            copy->text.len = cur->text.len;
+        }
+        copy->lazy_next = cur->lazy_next;
+        copy->lazy_end = cur->lazy_end;
+        copy->size = cur->size;
+        copy->leaves = cur->leaves;
+        copy->height = cur->height;
+        copy->tallest = cur->tallest;
+        if ( parent ){
+            copy->p = parent;
+            insertChild(parent, copy, -1);
+        }
+        else
+            root = copy->p = copy;
+        parent = copy;
+    }
+    walkEnd(&walk);
+    return root;
+}
+
+// sets the text of a node that is not indexed yet, as the loaders do
+void loadNodeText(Node* node, char* text){
+    size_t len = strnlen(text, MAX_TEXT_LEN - 1);
+    if ( node->text.size ){
+        memcpy(node->text.buf, text, len);
+        memset(node->text.buf + len, 0, node->text.size - len);
+    }
+    else
+        nodeTextStore(node, text, len);
+    node->text.len = len;
+    layoutInvalidate();
+}
+
+void setNodeText(Node* node, char* text){
+    loadNodeText(node, text);
+    searchMarkDirty(node);
+}
+
+// "." for the root, ".i.j" for the j-th child of the root's i-th child
+char* nodePath(Node* node){
+    int depth = 0;
+    for (Node* n = node; n != GRAPH.root; n = n->p)
+        depth++;
+    int* indices = memCalloc(MemOther, depth + 1, sizeof(int));
+    int level = depth;
+    for (Node* n = node; n != GRAPH.root; n = n->p)
+        indices[--level] = childIndex(n);
+    char* path = memCalloc(MemOther, depth * 12 + 2, sizeof(char));
+    int len = 0;
+    for (int i = 0; i < depth; i++)
+        len += sprintf(path + len, ".%d", indices[i]);
+    if ( depth == 0 )
+        strcpy(path, ".");
+    memFree(MemOther, indices);
+    return path;
+}
+
+// number of nodes in a subtree, including its root
+size_t subtreeSize(Node* node){
+    return node->size;
+}
+
+/* Every node carries the size, leaf count and height of its subtree. attachNode, unlinkNode
+ * and makeChild adjust the ancestors of the node they add or remove: the counts in O(depth),
+ * the height until an ancestor's height stays the same. Each node also counts its tallest
+ * children, so that removing a child only rescans its siblings once the last of those goes.
+ * Loaders build whole subtrees before anything else sees them and fill them in once with
+ * aggregateSubtree. In lazy mode they only cover the loaded nodes. */
+
+// the root of the tree or of a subtree under construction has no parent to update
+static Node* aggregateParent(Node* node){
+    return node->p == node ? NULL : node->p;
+}
+
+// sets the height to 1 + the height of the tallest child, from the children's own heights
+static void aggregateHeight(Node* node){
+    node->height = 0;
+    node->tallest = 0;
+    for (int i = 0; i < node->children->num; i++) {
+        int height = node->children->array[i]->height + 1;
+        if ( height > node->height ){
+            node->height = height;
+            node->tallest = 1;
+        }
+        else if ( height == node->height )
+            node->tallest++;
+    }
+}
+
+// node has just been added to the children of node->p
+void aggregateAttach(Node* node){
+    size_t leaves = node->leaves - (node->p->children->num == 1);  // a leaf parent stops being one
+    int height = node->height + 1;
+    for (Node* n = node->p; n; n = aggregateParent(n)) {
+        n->size += node->size;
+        n->leaves += leaves;
+        if ( height > n->height ){
+            n->height = height++;
+            n->tallest = 1;
+        }
+        else {
+            if ( height == n->height )
+                n->tallest++;
+            height = 0;
+        }
+    }
+}
+
+// node has just been removed from the children of parent
+void aggregateDetach(Node* node, Node* parent){
+    size_t leaves = node->leaves - (parent->children->num == 0);  // a parent left childless is a leaf
+    bool lower = true;
+    int height = node->height;  // of the child of n that was removed or got lower, before the change
+    for (Node* n = parent; n; n = aggregateParent(n)) {
+        n->size -= node->size;
+        n->leaves -= leaves;
+        if ( lower ){
+            lower = height + 1 == n->height && --n->tallest == 0;
+            height = n->height;
+            if ( lower )
+                aggregateHeight(n);
+        }
+    }
+}
+
+// computes the aggregates of every node of a subtree from scratch, in one walk
+void aggregateSubtree(Node* node){
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); ) {
+        if ( walk.pre ) continue;
+        cur->size = 1;
+        cur->leaves = cur->children->num ? 0 : 1;
+        for (int i = 0; i < cur->children->num; i++) {
+            cur->size += cur->children->array[i]->size;
+            cur->leaves += cur->children->array[i]->leaves;
+        }
+        aggregateHeight(cur);
+    }
+    walkEnd(&walk);
+}
+
+#define FNV_OFFSET 14695981039346656037ULL
+unsigned long long fnv1a(unsigned long long hash, char* buf, size_t len){
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char) buf[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Utility function for removing a node & subtree from graph
+void removeNodeFromGraph(Node* node){
+    if ( node == GRAPH.root ) return;
+    logPrint("Removing node from graph...\n");
+    journalDelete(node);
+    int index = detachNode(node);
+    searchForgetSubtree(node);
+    // the undo log keeps the subtree alive and frees it once the delete can no longer be undone
+    undoRecordDelete(node, node->p, index);
     logPrint("Removed node from graph.\n");
 }
 
@@ -363,6 +995,11 @@ int getHeight (char* message, bool wrap){
         return TEXTBOX_HEIGHT;
 }
 
+// height of the text box of a node, which shows at most MAX_NODE_LINES of its wrapped text
+int nodeTextHeight(char* text){
+    return min(getHeight(text, true), MAX_NODE_LINES * TEXTBOX_HEIGHT);
+}
+
 
 char* getEndOfLine(char* line_start, int wrap){
     if ( !*line_start ) return NULL;
@@ -393,7 +1030,7 @@ char** getLines(char* message, int wrap){
     logPrint("getLines()\n");
     int height = getHeight(message, wrap);
     int cur_line = 0;
-    char** lines = calloc(height/TEXTBOX_HEIGHT + 1, sizeof(char*));
+    char** lines = memCalloc(MemLines, height/TEXTBOX_HEIGHT + 1, sizeof(char*));
     char* tok = message;
     char* line_end;
 
@@ -402,7 +1039,7 @@ char** getLines(char* message, int wrap){
         if ( !line_end ) break;
         int line_len = ( line_end - tok );
         logPrint("line len: %p - %p=%d\n", line_end, tok, line_len);
-        lines[cur_line] = calloc(line_len + 1, sizeof(char));
+        lines[cur_line] = memCalloc(MemLines, line_len + 1, sizeof(char));
         // copy all chars up until line_end
         for (int i = 0; i < line_len; i++) {
             if ( i != line_len - 1 || *(tok+i) != '\n')
@@ -419,10 +1056,146 @@ char** getLines(char* message, int wrap){
 
 void freeLines(char** lines){
     for (int i = 0; lines[i]; i++)
-        free(lines[i]);
-    free(lines);
+        memFree(MemLines, lines[i]);
+    memFree(MemLines, lines);
+}
+
+// STRING INTERNING
+/* Node text lives in a table of reference counted strings, one copy per
+ * distinct text, so a tree of repeated labels costs memory per label rather
+ * than per node. Texts shorter than NODE_INLINE_TEXT skip the table and are
+ * kept in the node's text_inline, which costs less than a table entry and is
+ * read without following another pointer. A node whose text.size is 0 points
+ * either into the table or at its own text_inline and must not be written;
+ * it gets a private MAX_TEXT_LEN buffer only while edited. */
+typedef struct InternString InternString;
+struct InternString {
+    struct InternString* next;  // next string in the same bucket
+    unsigned int hash;
+    unsigned int refs;
+    char text[];
+};
+
+static InternString** INTERN_BUCKETS = NULL;
+static size_t INTERN_NUM_BUCKETS = 0;  // a power of two
+static size_t INTERN_COUNT = 0;        // distinct strings in the table
+static size_t INTERN_REFS = 0;         // references held by nodes
+static Node* UNSHARED_NODE = NULL;     // the node with a private text buffer, if any
+
+static InternString* internEntry(char* text){
+    return (InternString*) (text - offsetof(InternString, text));
+}
+
+static void internGrow(){
+    size_t num_buckets = INTERN_NUM_BUCKETS ? 2 * INTERN_NUM_BUCKETS : 1024;
+    InternString** buckets = memCalloc(MemText, num_buckets, sizeof(InternString*));
+    for (size_t i = 0; i < INTERN_NUM_BUCKETS; i++) {
+        InternString* next;
+        for (InternString* entry = INTERN_BUCKETS[i]; entry; entry = next) {
+            next = entry->next;
+            entry->next = buckets[entry->hash & (num_buckets - 1)];
+            buckets[entry->hash & (num_buckets - 1)] = entry;
+        }
+    }
+    if ( INTERN_BUCKETS ) memFree(MemText, INTERN_BUCKETS);
+    INTERN_BUCKETS = buckets;
+    INTERN_NUM_BUCKETS = num_buckets;
+}
+
+// returns the shared copy of the first len bytes of text, holding a reference to it
+char* internString(char* text, size_t len){
+    if ( INTERN_COUNT >= INTERN_NUM_BUCKETS )
+        internGrow();
+    unsigned int hash = (unsigned int) fnv1a(FNV_OFFSET, text, len);
+    InternString** bucket = &INTERN_BUCKETS[hash & (INTERN_NUM_BUCKETS - 1)];
+    for (InternString* entry = *bucket; entry; entry = entry->next) {
+        if ( entry->hash == hash && strncmp(entry->text, text, len) == 0 && entry->text[len] == '\0' ){
+            entry->refs++;
+            INTERN_REFS++;
+            return entry->text;
+        }
+    }
+    InternString* entry = memMalloc(MemText, sizeof(InternString) + len + 1);
+    entry->hash = hash;
+    entry->refs = 1;
+    memcpy(entry->text, text, len);
+    entry->text[len] = '\0';
+    entry->next = *bucket;
+    *bucket = entry;
+    INTERN_COUNT++;
+    INTERN_REFS++;
+    return entry->text;
+}
+
+// takes another reference to a string returned by internString
+char* internRetain(char* text){
+    internEntry(text)->refs++;
+    INTERN_REFS++;
+    return text;
+}
+
+// drops a reference taken by internString, freeing the string with its last one
+void internRelease(char* text){
+    InternString* entry = internEntry(text);
+    INTERN_REFS--;
+    if ( --entry->refs ) return;
+    InternString** link = &INTERN_BUCKETS[entry->hash & (INTERN_NUM_BUCKETS - 1)];
+    while ( *link != entry )
+        link = &(*link)->next;
+    *link = entry->next;
+    INTERN_COUNT--;
+    memFree(MemText, entry);
+}
+
+bool nodeTextInline(Node* node){
+    return node->text.buf == node->text_inline;
+}
+
+// replaces the read-only text of a node, inline if it fits and in the table otherwise
+void nodeTextStore(Node* node, char* text, size_t len){
+    char* shared = nodeTextInline(node) ? NULL : node->text.buf;
+    if ( len < NODE_INLINE_TEXT ){
+        memmove(node->text_inline, text, len);
+        node->text_inline[len] = '\0';
+        node->text.buf = node->text_inline;
+    }
+    else
+        node->text.buf = internString(text, len);
+    node->text.len = len;
+    // released last, text may point into it
+    if ( shared ) internRelease(shared);
+}
+
+// copy on write: gives the node a private buffer that the Edit mode can write into
+void nodeTextUnshare(Node* node){
+    if ( node->text.size ) return;
+    if ( UNSHARED_NODE ) nodeTextShare(UNSHARED_NODE);
+    char* shared = nodeTextInline(node) ? NULL : node->text.buf;
+    node->text.buf = memCalloc(MemText, MAX_TEXT_LEN, sizeof(char));
+    node->text.size = MAX_TEXT_LEN;
+    memcpy(node->text.buf, shared ? shared : node->text_inline, node->text.len);
+    if ( shared ) internRelease(shared);
+    UNSHARED_NODE = node;
+}
+
+// puts the text of an edited node back in the node or the table
+void nodeTextShare(Node* node){
+    if ( !node || !node->text.size ) return;
+    char* private = node->text.buf;
+    node->text.buf = node->text_inline;
+    node->text.size = 0;
+    nodeTextStore(node, private, node->text.len);
+    memFree(MemText, private);
+    if ( UNSHARED_NODE == node ) UNSHARED_NODE = NULL;
+}
+
+void nodeTextRelease(Node* node){
+    if ( UNSHARED_NODE == node ) UNSHARED_NODE = NULL;
+    if ( node->text.size ) memFree(MemText, node->text.buf);
+    else if ( !nodeTextInline(node) ) internRelease(node->text.buf);
 }
 
+
 // READ/WRITE
 
 // We replace user-entered \n with | for the file format
@@ -453,752 +1226,4665 @@ void endAtNewline(char* string, int text_len){
     }
 }
 
-void readFile(){
-    FILE* fp = fopen(FILENAME_BUFFER.buf, "r");
-    if ( !fp )
-        return;
-    /* buffer to store lines */
-    char* buf = calloc(MAX_TEXT_LEN, sizeof(char));
-    /* load first line of file */
-    char* ret = fgets(buf, MAX_TEXT_LEN, fp);
-    /* keep references to all nodes that can have children added,
-     * one per each level */
-    Node** hierarchy = calloc(MAX_TEXT_LEN, sizeof(Node*));
-    unsigned int level = 0;
-    /* Load graph root manually */
-    hierarchy[0] = GRAPH.root;
-    endAtNewline(ret, strlen(ret));
-    replaceChar(ret, '|', '\n');
-    strcpy(GRAPH.root->text.buf, ret);
-    GRAPH.root->text.len = strlen(ret);
-    while ( true ){
-        /* loads next line */
-        ret = fgets(buf, MAX_TEXT_LEN, fp);
-        /* reached EOF */
-        if ( ret != buf )
-            break;
-        /* remove any trailing newlines */
-        endAtNewline(ret, strlen(ret));
-        replaceChar(ret, '|', '\n');
-        /* determine level in tree by number of tabs */
-        level = countTabs(ret);
-        /* create new child node */
-        hierarchy[level] = makeChild(hierarchy[level-1]);
-        /* copy current line to child node, offset by number of tabs */
-        strcpy(hierarchy[level]->text.buf, ret + level);
-        hierarchy[level]->text.len = strlen(ret + level); // for some reason I need to have a -1 here
-    }
-    fclose(fp);
-    free(buf);
-    free(hierarchy);
+/* Outlines are read and written as a stream of (level, text) events, one
+ * per node in document order, with the root at level 0. Every reader feeds
+ * a Loader, which either builds nodes with makeChild or, when it has a
+ * Saver, writes each node straight out again so files can be converted
+ * without holding the tree. Readers and writers keep only a few bytes of
+ * state per open level. */
+struct Saver {
+    FILE* file;
+    enum OutlineFormat format;
+    int depth;          // nodes opened and not yet closed
+    bool tag_open;      // last opened node has not been told if it has children
+};
+
+struct Loader {
+    Node* root;         // preset root to fill, or the first node loaded
+    Array* hierarchy;   // last node loaded on each level
+    Saver* saver;       // if set, nodes are written out instead of built
+    Query* query;       // if set, nodes are only shown to a batch query
+    bool index;         // add loaded nodes to the search index
+};
+
+enum OutlineFormat outlineFormat(char* path){
+    char* extension = strrchr(path, '.');
+    if ( extension && strcasecmp(extension, ".opml") == 0 ) return Opml;
+    if ( extension && strcasecmp(extension, ".json") == 0 ) return Json;
+    return Native;
 }
 
- /* Recursively print children of nodes, with each child indented once from the parent */
-void writeChildrenStrings(FILE* file, Node* node, int level){
-    for(int i=0; i<level;i++)
-        fprintf(file, "\t");
-    replaceChar(node->text.buf, '\n', '|');
-    fprintf(file, "%s\n", node->text.buf);
-    replaceChar(node->text.buf, '|', '\n');
-    for (int i=0; i<node->children->num; i++)
-        writeChildrenStrings(file, node->children->array[i], level + 1);
+void loaderBegin(Loader* loader, Node* root, Saver* saver){
+    loader->root = root;
+    loader->hierarchy = saver ? NULL : initTaggedArray(16, MemFiles);
+    loader->saver = saver;
+    loader->query = NULL;
+    loader->index = false;
 }
 
-void writeFile(){
-    if ( FILENAME_BUFFER.buf == NULL ) return;
-    FILE* output = fopen(FILENAME_BUFFER.buf, "w");
-    writeChildrenStrings(output, GRAPH.root, 0);
-    fclose(output);
-    unwritten = 0;
+void loaderEnd(Loader* loader){
+    if ( !loader->hierarchy ) return;
+    if ( loader->root ) aggregateSubtree(loader->root);
+    freeArray(loader->hierarchy);
 }
 
+// adds a node below the last node loaded on the previous level, returns NULL when saving or querying
+Node* loaderAdd(Loader* loader, int level, char* text){
+    if ( loader->query ){
+        queryNode(loader->query, level, text);
+        return NULL;
+    }
+    if ( loader->saver ){
+        saverNode(loader->saver, loader->saver->depth ? max(1, min(level, loader->saver->depth)) : 0, text);
+        return NULL;
+    }
+    Node* node;
+    if ( loader->hierarchy->num == 0 ){
+        if ( !loader->root ) loader->root = makeNode();
+        node = loader->root;
+        level = 0;
+    }
+    else {
+        // linked directly, loaderEnd computes the aggregates of the whole subtree at once
+        level = max(1, min(level, loader->hierarchy->num));
+        node = makeNode();
+        node->p = loader->hierarchy->array[level-1];
+        insertChild(node->p, node, -1);
+    }
+    loadNodeText(node, text);
+    if ( loader->index ) searchIndexNode(node);
+    loader->hierarchy->num = level;
+    insertArray(loader->hierarchy, node);
+    return node;
+}
 
-// HINT MANAGEMENT
+// replaces the text of the last node loaded on a level, for formats that may give it late
+void loaderSetText(Loader* loader, int level, char* text){
+    if ( loader->hierarchy && level < loader->hierarchy->num )
+        loadNodeText(loader->hierarchy->array[level], text);
+}
 
-void calculateNeighbors(Node* root, Node* selected) {
-    LEFT_NEIGHBOR = NULL;
-    RIGHT_NEIGHBOR = NULL;
-    if (selected == root)
-       return;
+// native format: one node per line, indented by tabs, with | for newlines
+void importNative(FILE* fp, Loader* loader, long long num_lines, unsigned long long* hash){
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t line_len;
+    for (long long i = 0; i != num_lines && (line_len = getline(&line, &cap, fp)) > 0; i++) {
+        if ( hash ) *hash = fnv1a(*hash, line, line_len);
+        endAtNewline(line, line_len);
+        replaceChar(line, '|', '\n');
+        unsigned int level = countTabs(line);
+        loaderAdd(loader, level, line + level);
+    }
+    free(line);
+}
 
-    //                     buffer overflow waiting to happen
-    //                     VVVV
-    Node** queue =  calloc(81920, sizeof(Node*));
-    int* node_depths =  calloc(81920, sizeof(int));
+// appends a code point to a bounded buffer as UTF-8, or a raw byte of already encoded text
+void appendCodePoint(char* buf, int* len, int cap, long code, bool raw){
+    char bytes[4];
+    int num = 0;
+    if ( code < 0x80 || raw ) bytes[num++] = code;
+    else if ( code < 0x800 ){
+        bytes[num++] = 0xc0 | (code >> 6);
+        bytes[num++] = 0x80 | (code & 0x3f);
+    }
+    else if ( code < 0x10000 ){
+        bytes[num++] = 0xe0 | (code >> 12);
+        bytes[num++] = 0x80 | ((code >> 6) & 0x3f);
+        bytes[num++] = 0x80 | (code & 0x3f);
+    }
+    else {
+        bytes[num++] = 0xf0 | (code >> 18);
+        bytes[num++] = 0x80 | ((code >> 12) & 0x3f);
+        bytes[num++] = 0x80 | ((code >> 6) & 0x3f);
+        bytes[num++] = 0x80 | (code & 0x3f);
+    }
+    if ( *len + num >= cap ) return;
+    memcpy(buf + *len, bytes, num);
+    *len += num;
+    buf[*len] = '\0';
+}
 
-    queue[0] = root;
-    int index = 0;
-    int queue_len = 1;
-    bool found = false;
+// reads the rest of an XML entity after '&'
+long xmlEntity(FILE* fp){
+    char name[12];
+    int len = 0, c;
+    while ( (c = getc(fp)) != EOF && c != ';' && len < (int) sizeof(name) - 1 )
+        name[len++] = c;
+    name[len] = '\0';
+    if ( name[0] == '#' )
+        return name[1] == 'x' ? strtol(name + 2, NULL, 16) : strtol(name + 1, NULL, 10);
+    if ( strcmp(name, "amp") == 0 )  return '&';
+    if ( strcmp(name, "lt") == 0 )   return '<';
+    if ( strcmp(name, "gt") == 0 )   return '>';
+    if ( strcmp(name, "quot") == 0 ) return '"';
+    if ( strcmp(name, "apos") == 0 ) return '\'';
+    return '?';
+}
 
-    while ( index != queue_len ) {
-        Node* cur = queue[index];
-        if (index > 0 && queue[index] == selected) {
-            found = true;
-            break;
-        }
-        // add children to the queue
-        for(int i = 0; i < cur->children->num; i++) {
-            queue[queue_len] = cur->children->array[i];
-            node_depths[queue_len] = node_depths[index]+1;
-            queue_len++;
+// skips to the end of a tag, minding quoted attribute values
+int xmlSkipTag(FILE* fp){
+    int c, quote = 0;
+    while ( (c = getc(fp)) != EOF ){
+        if ( quote ){
+            if ( c == quote ) quote = 0;
         }
-        index++;
+        else if ( c == '"' || c == '\'' ) quote = c;
+        else if ( c == '>' ) break;
     }
-    if (found) {
-        if(node_depths[index] == node_depths[index-1])
-            LEFT_NEIGHBOR = queue[index-1];
-        if(node_depths[index] == node_depths[index+1])
-            RIGHT_NEIGHBOR = queue[index+1];
+    return c;
+}
+
+// reads the attributes of an outline tag, keeping only text; returns true if the tag closed itself
+bool opmlAttributes(FILE* fp, char* text){
+    char name[16];
+    int c, text_len = 0, prev = 0;
+    text[0] = '\0';
+    while ( (c = getc(fp)) != EOF && c != '>' ){
+        if ( c == '/' ) prev = c;
+        if ( isspace(c) || c == '/' ) continue;
+        int name_len = 0;
+        for (; c != EOF && c != '=' && !isspace(c) && c != '>'; c = getc(fp))
+            if ( name_len < (int) sizeof(name) - 1 ) name[name_len++] = c;
+        name[name_len] = '\0';
+        while ( c != EOF && c != '"' && c != '\'' && c != '>' ) c = getc(fp);
+        if ( c == '>' || c == EOF ) break;
+        int quote = c;
+        bool keep = strcmp(name, "text") == 0;
+        while ( (c = getc(fp)) != EOF && c != quote ){
+            if ( !keep ) continue;
+            appendCodePoint(text, &text_len, MAX_TEXT_LEN, c == '&' ? xmlEntity(fp) : c, c != '&');
+        }
+        prev = 0;
     }
-    free(queue);
-    free(node_depths);
+    return prev == '/';
 }
 
-void clearHintText() {
-    logPrint("clearHintText()\n");
-    // return if already freed
-    logPrint("Hint nodes %p", HINT_NODES);
-    logPrint("Hint nodes array %p", HINT_NODES->array);
-    logPrint("Hint nodes %p, num %ld\n", HINT_NODES->array, HINT_NODES->num);
-    // Clear all hint text in each hint node
-    for (int i = 0; i < HINT_NODES->num; ++i) {
-        for (int j = 0; j < HINT_BUFFER.size; j++) {
-            if (HINT_NODES->array[i]->hint_text){
-                HINT_NODES->array[i]->hint_text[j] = '\0';
-            }
+// OPML: the title becomes the root, outline elements its descendants
+bool importOpml(FILE* fp, Loader* loader){
+    char* text = memCalloc(MemFiles, MAX_TEXT_LEN, sizeof(char));
+    char name[16];
+    int c, depth = 0, text_len = 0;
+    bool in_title = false, root_loaded = false;
+    while ( (c = getc(fp)) != EOF ){
+        if ( c != '<' ){
+            if ( in_title && !(text_len == 0 && isspace(c)) )
+                appendCodePoint(text, &text_len, MAX_TEXT_LEN, c == '&' ? xmlEntity(fp) : c, c != '&');
+            continue;
+        }
+        int name_len = 0;
+        while ( (c = getc(fp)) != EOF && !isspace(c) && c != '>' && !(c == '/' && name_len > 0) )
+            if ( name_len < (int) sizeof(name) - 1 ) name[name_len++] = c;
+        name[name_len] = '\0';
+        if ( strncmp(name, "!--", 3) == 0 ){
+            // comments end at the first -->
+            int dashes = name_len >= 5 && strcmp(name + name_len - 2, "--") == 0 ? 2 : 0;
+            for (; c != EOF && !(c == '>' && dashes >= 2); c = getc(fp))
+                dashes = c == '-' ? dashes + 1 : 0;
+            continue;
         }
+        if ( strcmp(name, "title") == 0 && !root_loaded ){
+            in_title = true;
+            text_len = 0;
+            text[0] = '\0';
+        }
+        else if ( strcmp(name, "/title") == 0 ){
+            while ( text_len > 0 && isspace(text[text_len-1]) ) text[--text_len] = '\0';
+            in_title = false;
+        }
+        else if ( strcmp(name, "outline") == 0 ){
+            if ( !root_loaded ) loaderAdd(loader, 0, in_title ? "" : text);
+            root_loaded = true;
+            bool closed = false;
+            text[0] = '\0';
+            if ( c == '/' ) closed = xmlSkipTag(fp) == '>';
+            else if ( c != '>' ) closed = opmlAttributes(fp, text);
+            loaderAdd(loader, depth + 1, text);
+            if ( !closed ) depth++;
+            continue;
+        }
+        else if ( strcmp(name, "/outline") == 0 )
+            depth = max(0, depth - 1);
+        else if ( strcmp(name, "body") == 0 && !root_loaded ){
+            loaderAdd(loader, 0, text);
+            root_loaded = true;
+        }
+        if ( c != '>' ) xmlSkipTag(fp);
     }
-    // Clear hint node array
-    logPrint("Freeing HINT_NODES\n");
-    /* HINT_NODES = freeArray ( HINT_NODES ); */
-    HINT_NODES->num = 0;
-    logPrint("HINT_NODES: %p\n", HINT_NODES);
-    logPrint("End clearHintText()\n");
+    if ( !root_loaded ) loaderAdd(loader, 0, text);
+    memFree(MemFiles, text);
+    return true;
 }
 
-// Add all visible nodes to HINT_NODES
-void populateHintNodes(Node* node){
-    if ( !node ) return;
-    if ( node == GRAPH.selected->p ) insertArray(HINT_NODES, node);
-    logPrint("Adding hint node: %dx%d\n", node->pos.x, node->pos.y);
-    if (-(2*getWidth(node->text.buf, true)) <= node->pos.x &&
-        node->pos.x < APP.window_size.x+(2*getWidth(node->text.buf, true)) &&
-        RADIUS < node->pos.y &&
-        node->pos.y < APP.window_size.y+(2*getHeight(node->text.buf, true))) {
-        insertArray(HINT_NODES, node);
+// reads one JSON token; strings are decoded into buf, other scalars are consumed
+int jsonToken(FILE* fp, char* buf){
+    int c;
+    while ( (c = getc(fp)) != EOF && isspace(c) );
+    if ( c == EOF || strchr("{}[]:,", c) ) return c;
+    if ( c != '"' ){
+        while ( (c = getc(fp)) != EOF && !isspace(c) && !strchr("{}[]:,", c) );
+        if ( c != EOF ) ungetc(c, fp);
+        return 'v';
     }
-    for (int i = 0; i < node->children->num; ++i) {
-        logPrint("Going to next child\n");
-        populateHintNodes(node->children->array[i]);
+    int len = 0;
+    buf[0] = '\0';
+    while ( (c = getc(fp)) != EOF && c != '"' ){
+        long code = c;
+        bool raw = c != '\\';
+        if ( !raw ){
+            switch ( c = getc(fp) ){
+                case 'n': code = '\n'; break;
+                case 't': code = '\t'; break;
+                case 'r': code = '\r'; break;
+                case 'b': code = '\b'; break;
+                case 'f': code = '\f'; break;
+                case 'u': {
+                    char hex[5] = {0};
+                    if ( fread(hex, 1, 4, fp) != 4 ) return EOF;
+                    code = strtol(hex, NULL, 16);
+                    // a high surrogate is followed by the escaped low one
+                    if ( code >= 0xd800 && code < 0xdc00 && getc(fp) == '\\' && getc(fp) == 'u' && fread(hex, 1, 4, fp) == 4 )
+                        code = 0x10000 + ((code - 0xd800) << 10) + (strtol(hex, NULL, 16) - 0xdc00);
+                    break;
+                }
+                default: code = c;
+            }
+        }
+        appendCodePoint(buf, &len, MAX_TEXT_LEN, code, raw);
     }
+    return c == '"' ? '"' : EOF;
 }
 
-void populateHintText(Node* node){
-
-    logPrint("Populate start\n");
-    calculateNeighbors(GRAPH.root, GRAPH.selected);
-    clearHintText();
-    logPrint("HintTextCleared\n");
-    if(LEFT_NEIGHBOR) insertArray(HINT_NODES, LEFT_NEIGHBOR);
-    if(RIGHT_NEIGHBOR) insertArray(HINT_NODES, RIGHT_NEIGHBOR);
-    populateHintNodes(GRAPH.root);
-    logPrint("Hint Nodes Populated\n");
-
-    char* prefix = "";
-    int front = 0, back=0, done=0;
-    while ( !done ){
-        for (int i = 0; i < strlen(HINT_CHARS); ++i) {
-            // blacklist hard-coded hints
-            if (HINT_CHARS[i] == 'k' || HINT_CHARS[i] == 'h' || HINT_CHARS[i] == 'l' || HINT_CHARS[i] == 'j')
-                continue;
+// skips a value whose first token has been read
+void jsonSkipValue(FILE* fp, int token, char* buf){
+    int nesting = token == '{' || token == '[';
+    while ( nesting > 0 && (token = jsonToken(fp, buf)) != EOF ){
+        if ( token == '{' || token == '[' ) nesting++;
+        else if ( token == '}' || token == ']' ) nesting--;
+    }
+}
 
-            strcpy(HINT_TEXT_QUEUE[back], prefix);
-            HINT_TEXT_QUEUE[back][strlen(prefix)] = HINT_CHARS[i];
-            if ( back - front == HINT_NODES->num){
-                done = 1;
-                logPrint("breaking\n");
-                break;
+// JSON: {"text": ..., "children": [...]} objects; a top level array gets an empty root
+bool importJson(FILE* fp, Loader* loader){
+    char* buf = memCalloc(MemFiles, MAX_TEXT_LEN, sizeof(char));
+    int token = jsonToken(fp, buf);
+    int level = 0;
+    bool pending = true;        // node at level has not been loaded yet
+    bool in_children = false;
+    bool top_array = token == '[';
+    if ( top_array ){
+        loaderAdd(loader, 0, "");
+        pending = false;
+        in_children = true;
+    }
+    bool valid = top_array || token == '{';
+    while ( valid && (token = jsonToken(fp, buf)) != EOF ){
+        if ( token == ',' ) continue;
+        if ( in_children ){
+            if ( token == ']' && top_array && level == 0 ) break;
+            if ( token == ']' ) in_children = false;
+            else if ( token == '{' ){
+                level++;
+                pending = true;
+                in_children = false;
             }
-            back++;
+            else jsonSkipValue(fp, token, buf);
+            continue;
+        }
+        if ( token == '}' ){
+            if ( pending ) loaderAdd(loader, level, "");
+            pending = false;
+            if ( level-- == 0 ) break;
+            in_children = true;
+            continue;
         }
-        prefix = HINT_TEXT_QUEUE[front++];
+        if ( token != '"' || jsonToken(fp, buf) != ':' ){
+            valid = false;
+            break;
+        }
+        bool is_text = strcmp(buf, "text") == 0;
+        bool is_children = strcmp(buf, "children") == 0;
+        token = jsonToken(fp, buf);
+        if ( is_text && token == '"' ){
+            if ( pending ) loaderAdd(loader, level, buf);
+            else loaderSetText(loader, level, buf);
+            pending = false;
+        }
+        else if ( is_children && token == '[' ){
+            if ( pending ) loaderAdd(loader, level, "");
+            pending = false;
+            in_children = true;
+        }
+        else jsonSkipValue(fp, token, buf);
     }
-    for (int i = 0; i < HINT_NODES->num; i++)
-        strcpy(HINT_NODES->array[i]->hint_text, HINT_TEXT_QUEUE[front + i]);
+    if ( !valid ) fprintf(stderr, "Invalid JSON outline, stopped reading at offset %ld\n", ftell(fp));
+    memFree(MemFiles, buf);
+    return valid;
+}
 
-    // parent is 'k', left neighbor 'h', right neighbor 'l'
-    strcpy(node->p->hint_text,"k");
-    strcpy(node->hint_text,"j");
-    if (LEFT_NEIGHBOR)
-        strcpy(LEFT_NEIGHBOR->hint_text, "h");
-    if (RIGHT_NEIGHBOR)
-        strcpy(RIGHT_NEIGHBOR->hint_text, "l");
-    logPrint("Populate end.\n");
+bool importOutline(FILE* fp, enum OutlineFormat format, Loader* loader, unsigned long long* hash){
+    // the other formats are parsed a character at a time, so their bytes are hashed up front
+    if ( hash && format != Native ){
+        char buf[4096];
+        size_t len;
+        long start = ftell(fp);
+        while ( (len = fread(buf, 1, sizeof(buf), fp)) > 0 )
+            *hash = fnv1a(*hash, buf, len);
+        fseek(fp, start, SEEK_SET);
+    }
+    switch ( format ){
+        case Opml: return importOpml(fp, loader);
+        case Json: return importJson(fp, loader);
+        default: importNative(fp, loader, -1, hash); return true;
+    }
 }
 
+void xmlEscape(FILE* file, char* text){
+    for (; *text; text++) {
+        switch ( *text ){
+            case '&':  fputs("&amp;", file); break;
+            case '<':  fputs("&lt;", file); break;
+            case '>':  fputs("&gt;", file); break;
+            case '"':  fputs("&quot;", file); break;
+            case '\n': fputs("&#10;", file); break;
+            case '\t': fputs("&#9;", file); break;
+            default: fputc(*text, file);
+        }
+    }
+}
 
-// EVENT HANDLING
+void jsonEscape(FILE* file, char* text){
+    fputc('"', file);
+    for (; *text; text++) {
+        switch ( *text ){
+            case '"':  fputs("\\\"", file); break;
+            case '\\': fputs("\\\\", file); break;
+            case '\n': fputs("\\n", file); break;
+            case '\t': fputs("\\t", file); break;
+            default:
+                if ( (unsigned char) *text < 0x20 ) fprintf(file, "\\u%04x", *text);
+                else fputc(*text, file);
+        }
+    }
+    fputc('"', file);
+}
 
-void activateHints(){
-    populateHintText(GRAPH.selected);
-    switchCurrentBuffer(&HINT_BUFFER);
+void saverBegin(Saver* saver, FILE* file, enum OutlineFormat format){
+    saver->file = file;
+    saver->format = format;
+    saver->depth = 0;
+    saver->tag_open = false;
+    if ( format == Opml )
+        fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<opml version=\"2.0\">\n", file);
 }
 
-void switchCurrentBuffer(Buffer* buffer){
-    CURRENT_BUFFER = buffer;
-    CURSOR_POSITION = buffer->len - 1;
+static void saverIndent(Saver* saver, int level){
+    for (int i = 0; i < level; i++)
+        fputc('\t', saver->file);
 }
 
-void switchMode(enum Mode to){
-    if ( isHintMode(MODE) ){
-        HINT_NODES->num = 0;
-        clearBuffer(&HINT_BUFFER);
-    }
-    switch ( to ){
-        case Edit: switchCurrentBuffer(&GRAPH.selected->text); break;
-        case FilenameEdit: switchCurrentBuffer(&FILENAME_BUFFER); to = Edit; break;
-        case Travel: TOGGLE_MODE = false; break;
-        default: break;
+// closes the innermost open node
+void saverClose(Saver* saver){
+    int level = --saver->depth;
+    if ( saver->format == Opml ){
+        if ( level == 0 ) fputs(saver->tag_open ? "<body/>\n</opml>\n" : "</body>\n</opml>\n", saver->file);
+        else if ( saver->tag_open ) fputs("/>\n", saver->file);
+        else { saverIndent(saver, level); fputs("</outline>\n", saver->file); }
     }
-    MODE = to;
-    if ( isHintMode(to) )
-        activateHints();
+    else if ( saver->format == Json )
+        fputs(saver->tag_open ? "}" : "]}", saver->file);
+    saver->tag_open = false;
 }
 
-// When a hint node is selected, this function is run
-void hintFunction(Node* node){
-    logPrint("hintFunction()\n");
-    switch(MODE){
-        case Travel: GRAPH.selected = node; break;
-        case Delete: removeNodeFromGraph(node); break;
-        case Cut: CUT = node; switchMode(Paste); break;
-        case MakeChild: makeChild(node); activateHints(); break;
-        case Paste:
-            if ( !CUT || isInSubtree(CUT, node) ) break;
-            removeFromArray(CUT->p->children, CUT);
-            insertArray(node->children, CUT);
-            CUT->p = node;
-            CUT = NULL;
-            switchMode( Cut );
+// writes a node as the child of the innermost open node on level-1
+void saverNode(Saver* saver, int level, char* text){
+    while ( saver->depth > level )
+        saverClose(saver);
+    bool first_child = saver->tag_open;
+    if ( saver->tag_open ){
+        // the parent now knows it has children
+        if ( saver->format == Opml ) fputs(level == 1 ? "<body>\n" : ">\n", saver->file);
+        if ( saver->format == Json ) fputs(", \"children\": [\n", saver->file);
+    }
+    switch ( saver->format ){
+        case Opml:
+            if ( level == 0 ) fputs("<head>\n<title>", saver->file);
+            else { saverIndent(saver, level); fputs("<outline text=\"", saver->file); }
+            xmlEscape(saver->file, text);
+            fputs(level == 0 ? "</title>\n</head>\n" : "\"", saver->file);
             break;
-        default:
+        case Json:
+            if ( level > 0 && !first_child ) fputs(",\n", saver->file);
+            saverIndent(saver, level);
+            fputs("{\"text\": ", saver->file);
+            jsonEscape(saver->file, text);
             break;
+        default:
+            saverIndent(saver, level);
+            for (char* c = text; *c; c++)
+                fputc(*c == '\n' ? '|' : *c, saver->file);
+            fputc('\n', saver->file);
     }
-    if ( TOGGLE_MODE == false && MODE != Paste )
-        switchMode( Travel );
+    saver->tag_open = true;
+    saver->depth = level + 1;
 }
 
-void insertCharIntoCurrentBuffer(char c){
-    if ( !CURRENT_BUFFER || CURRENT_BUFFER->len < 0 || CURRENT_BUFFER->len >= CURRENT_BUFFER->size) return;
-    for (int i = CURRENT_BUFFER->len-1; i > CURSOR_POSITION; i--) {
-        CURRENT_BUFFER->buf[i+1] = CURRENT_BUFFER->buf[i];
+void saverEnd(Saver* saver){
+    while ( saver->depth > 0 )
+        saverClose(saver);
+    if ( saver->format == Json ) fputc('\n', saver->file);
+}
+
+void saveSubtree(Saver* saver, Node* node, int level){
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); ) {
+        if ( walk.pre )
+            saverNode(saver, level + walk.level, cur->text.buf);
+        else if ( cur->lazy_next >= 0 )
+            lazySaveDescendants(saver, cur, level + walk.level);
     }
-    CURRENT_BUFFER->buf[++CURSOR_POSITION] = c;
-    CURRENT_BUFFER->len += 1;
+    walkEnd(&walk);
+}
 
+// writes the whole tree in the given format
+void saveTree(FILE* file, enum OutlineFormat format){
+    if ( format == Native ){
+        writeChildrenStrings(file, GRAPH.root, 0);
+        return;
+    }
+    Saver saver;
+    saverBegin(&saver, file, format);
+    saveSubtree(&saver, GRAPH.root, 0);
+    saverEnd(&saver);
 }
-void deleteCharInBufferRelativeToCursor(int relative_position){
-    unwritten = 1;
-    // relative position allows us to use the same code for both backspace and delete
-    for (int i = CURSOR_POSITION + relative_position; i < CURRENT_BUFFER->len-1; i++) {
-        CURRENT_BUFFER->buf[i] = CURRENT_BUFFER->buf[i+1];
+
+// streams one outline file into another, possibly of a different format, without building the tree
+bool convertOutline(char* from, char* to){
+    FILE* input = fopen(from, "r");
+    if ( !input ){
+        fprintf(stderr, "Could not open %s: %s\n", from, strerror(errno));
+        return false;
     }
-    CURRENT_BUFFER->buf[CURRENT_BUFFER->len-1] = '\0';
-    CURSOR_POSITION -= 1 - relative_position;
-    CURRENT_BUFFER->len -= 1;
+    FILE* output = fopen(to, "w");
+    if ( !output ){
+        fprintf(stderr, "Could not open %s: %s\n", to, strerror(errno));
+        fclose(input);
+        return false;
+    }
+    Saver saver;
+    Loader loader;
+    saverBegin(&saver, output, outlineFormat(to));
+    loaderBegin(&loader, NULL, &saver);
+    bool converted = importOutline(input, outlineFormat(from), &loader, NULL);
+    loaderEnd(&loader);
+    saverEnd(&saver);
+    fclose(input);
+    converted = !ferror(output) && converted;
+    return !fclose(output) && converted;
 }
 
-void handleTextInput(SDL_Event *event){
-    if ( CURRENT_BUFFER && CURRENT_BUFFER->len < CURRENT_BUFFER->size ){
-        logPrint("Adding text to current buffer...\n");
-        int add_text = 1;
-        // skip adding to buffer for hint modes if not a valid hint char
-        if ( isHintMode(MODE) ){
-            add_text = 0;
-            for (int i = 0; i < strlen(HINT_CHARS); ++i){
-                if ( HINT_CHARS[i] == event->edit.text[0] ){
-                    add_text = 1;
-                    break;
-                }
+void readFile(){
+    FILE_HASH = FNV_OFFSET;
+    FILE* fp = fopen(FILENAME_BUFFER.buf, "r");
+    if ( !fp )
+        return;
+    Loader loader;
+    loaderBegin(&loader, GRAPH.root, NULL);
+    loader.index = true;
+    importOutline(fp, outlineFormat(FILENAME_BUFFER.buf), &loader, &FILE_HASH);
+    loaderEnd(&loader);
+    fclose(fp);
+}
+
+// reads num_lines lines of the file format into a new, detached subtree
+Node* readSubtree(FILE* fp, int num_lines){
+    Loader loader;
+    loaderBegin(&loader, NULL, NULL);
+    importNative(fp, &loader, num_lines, NULL);
+    loaderEnd(&loader);
+    return loader.root;
+}
+
+ /* Print a node and its descendants, with each child indented once from the parent */
+void writeChildrenStrings(FILE* file, Node* node, int level){
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); ) {
+        if ( !walk.pre ){
+            // children that are not loaded yet come after the loaded ones
+            if ( cur->lazy_next >= 0 )
+                lazyWriteDescendants(file, cur, level + walk.level);
+            continue;
+        }
+        for(int i=0; i<level + walk.level;i++)
+            fputc('\t', file);
+        // written a line of the text at a time, clipboard copies of big subtrees go through here
+        for (char* c = cur->text.buf; *c; ) {
+            size_t run = strcspn(c, "\n");
+            fwrite(c, 1, run, file);
+            c += run;
+            if ( *c ){
+                fputc('|', file);
+                c++;
             }
         }
-        else
-            unwritten = 1;
-
-        // Add text to buffer
-        if ( add_text ) insertCharIntoCurrentBuffer(event->edit.text[0]);
-        logPrint("Detected character: %c\n", event->edit.text[0]);
-        logPrint("New CURRENT_BUFFER: len %d: %s\n", CURRENT_BUFFER->len, CURRENT_BUFFER->buf);
+        fputc('\n', file);
     }
-    if ( isHintMode(MODE) ){
-        // go to node specified by travel chars
-        logPrint("Handling travel input: %d/%d chars\n", HINT_BUFFER.len, HINT_BUFFER.size);
-        // check if any nodes hint text matches current input
-        for (int i = 0; i < HINT_NODES->num; ++i) {
-            // continue if hint buffer != any hint text
-            if ( strcmp(HINT_BUFFER.buf, HINT_NODES->array[i]->hint_text) != 0 )
-                continue;
-            hintFunction(HINT_NODES->array[i]);
-            // reset hint text
+    walkEnd(&walk);
+}
 
-            logPrint("Freeing hint buffer\n");
-            clearBuffer(&HINT_BUFFER);
-            logPrint("Freed hint buffer\n");
+/* Cut and Copy also put the subtree on the system clipboard in the native format,
+ * so that another dtree, or any text editor, can paste it */
+void clipboardCopy(Node* node){
+    if ( REPLAYING ) return;
+    char* buf = NULL;
+    size_t len = 0;
+    FILE* stream = open_memstream(&buf, &len);
+    if ( !stream ) return;
+    writeChildrenStrings(stream, node, 0);
+    fclose(stream);
+    if ( SDL_SetClipboardText(buf) != 0 )
+        fprintf(stderr, "Could not copy to the clipboard: %s\n", SDL_GetError());
+    free(buf);
+}
 
-            logPrint("Re-calculating positions of nodes...\n");
-            calculatePositions(GRAPH.root, GRAPH.selected);
-            logPrint("Populating hint text...\n");
-            populateHintText(GRAPH.selected);
-            logPrint("Populated.\n");
-        }
-        logPrint("Handled hint input.\n");
+// parses the clipboard as a subtree in the native format, NULL if it holds no text
+Node* clipboardRead(){
+    if ( REPLAYING || !SDL_HasClipboardText() ) return NULL;
+    char* text = SDL_GetClipboardText();
+    Node* subtree = NULL;
+    FILE* fp = text && *text ? fmemopen(text, strlen(text), "r") : NULL;
+    if ( fp ){
+        subtree = readSubtree(fp, -1);
+        fclose(fp);
     }
+    SDL_free(text);
+    return subtree;
 }
 
-// Opens the file/url specified at the node
-void open_node_text(Node* node){
-    char buf[1024];
-    sprintf(buf, "xdg-open %s\n", node->text.buf);
-    system(buf);
+void writeFile(){
+    if ( FILENAME_BUFFER.buf == NULL || REPLAYING ) return;
+    if ( journalSave() || lazySave() ) return;
+    FILE* output = fopen(FILENAME_BUFFER.buf, "w");
+    saveTree(output, outlineFormat(FILENAME_BUFFER.buf));
+    fclose(output);
+    reloadRemember();
+    unwritten = 0;
 }
 
-// can only handle +1 and -1
-void moveCursorLine(int relative_line){
-    char** lines = getLines(GRAPH.selected->text.buf, true);
-    int len_so_far = 0;
 
-    for (int i = 0; lines[i]; i++) {
-            if ( CURSOR_POSITION < len_so_far - 1 || CURSOR_POSITION > len_so_far + (int) strlen(lines[i]) - 1 ) {
-                len_so_far += (int) strlen(lines[i]) + 1;
-                continue;
-            }
-            if ( relative_line == 1 && !lines[i+1] ) CURSOR_POSITION = CURRENT_BUFFER->len - 1;
-            if ( relative_line == -1 && i == 0 ) CURSOR_POSITION = -1;
+// JOURNAL
+
+/* Optional append-only journal (-j). Each change appends one line to
+ * <file>.journal naming nodes by their child-index path from the root:
+ *     c <parent> <index>            create an empty child
+ *     d <path>                      delete a subtree
+ *     m <path> <parent> <index>     move a subtree
+ *     t <path> <text>               replace a node's text
+ *     s <parent> <index> <lines>    insert a subtree, followed by <lines> lines of the file format
+ * The first line of a journal holds the hash of the base file it applies
+ * to, so a journal whose base has since been rewritten is recognised as
+ * stale instead of being replayed twice. Every JOURNAL_COMPACT_RECORDS
+ * records the tree is serialized to memory, the journal is rotated to
+ * <file>.journal.old and a background thread rewrites the base file. */
+static bool JOURNAL_MODE = false;
+static FILE* JOURNAL_FILE = NULL;
+static int JOURNAL_RECORDS = 0;           // records in the current journal
+static char JOURNAL_BASE_PATH[FILENAME_MAX];
+static char JOURNAL_PATH[FILENAME_MAX + 16];
+static char JOURNAL_OLD_PATH[FILENAME_MAX + 16];
+static char JOURNAL_TMP_PATH[FILENAME_MAX + 16];
+static SDL_Thread* JOURNAL_THREAD = NULL;
+static SDL_atomic_t JOURNAL_COMPACTING;    // set while JOURNAL_THREAD is writing the base file
+
+typedef struct JournalSnapshot JournalSnapshot;
+struct JournalSnapshot {
+    char* buf;
+    size_t len;
+};
 
-            int col = CURSOR_POSITION - len_so_far;
-            // Move Up
-            if ( relative_line == -1 && i > 0 ){
-                if ( col > (int) strlen(lines[i-1]) )
-                    CURSOR_POSITION -= col + 1 + 1;
-                else
-                    CURSOR_POSITION -= strlen(lines[i-1]) + 1;
-            }
-            // Move Down
-            else if ( relative_line == 1 && lines[i+1] ){
-                if ( col > (int) strlen(lines[i+1]) - 1 )
-                    CURSOR_POSITION += strlen(lines[i]) - col + strlen(lines[i+1]);
-                else
-                    CURSOR_POSITION += strlen(lines[i]) + 1;
-            }
-            break;
+static void journalWritePath(Node* node){
+    char* path = nodePath(node);
+    fputs(path, JOURNAL_FILE);
+    memFree(MemOther, path);
+}
+
+static void journalWriteText(char* text){
+    for (char* c = text; *c; c++)
+        fputc(*c == '\n' ? '|' : *c, JOURNAL_FILE);
+}
+
+static void journalCommit(){
+    fputc('\n', JOURNAL_FILE);
+    fflush(JOURNAL_FILE);
+    JOURNAL_RECORDS++;
+}
+
+void journalCreate(Node* node){
+    if ( !JOURNAL_FILE ) return;
+    fputs("c ", JOURNAL_FILE);
+    journalWritePath(node->p);
+    fprintf(JOURNAL_FILE, " %d", childIndex(node));
+    journalCommit();
+}
+
+// must be called while the node is still attached
+void journalDelete(Node* node){
+    if ( !JOURNAL_FILE ) return;
+    fputs("d ", JOURNAL_FILE);
+    journalWritePath(node);
+    journalCommit();
+}
+
+// from is the node's path before it was unlinked, as returned by nodePath
+void journalMove(char* from, Node* node){
+    if ( !JOURNAL_FILE ) return;
+    fprintf(JOURNAL_FILE, "m %s ", from);
+    journalWritePath(node->p);
+    fprintf(JOURNAL_FILE, " %d", childIndex(node));
+    journalCommit();
+}
+
+void journalText(Node* node){
+    if ( !JOURNAL_FILE || !node ) return;
+    fputs("t ", JOURNAL_FILE);
+    journalWritePath(node);
+    fputc(' ', JOURNAL_FILE);
+    journalWriteText(node->text.buf);
+    journalCommit();
+}
+
+// records a subtree that was attached as a whole (undo of a delete, redo of a create)
+void journalSubtree(Node* node){
+    if ( !JOURNAL_FILE ) return;
+    fputs("s ", JOURNAL_FILE);
+    journalWritePath(node->p);
+    fprintf(JOURNAL_FILE, " %d %zu\n", childIndex(node), subtreeSize(node));
+    writeChildrenStrings(JOURNAL_FILE, node, 0);
+    fflush(JOURNAL_FILE);
+    JOURNAL_RECORDS++;
+}
+
+// parses a path written by nodePath and advances *cursor past it and one separator
+static Node* journalResolve(char** cursor){
+    char* c = *cursor;
+    if ( *c != '.' ) return NULL;
+    Node* node = GRAPH.root;
+    c++;
+    while ( isdigit((unsigned char) *c) ){
+        long index = strtol(c, &c, 10);
+        if ( index >= node->children->num ) return NULL;
+        node = node->children->array[index];
+        if ( *c == '.' ) c++;
     }
-    freeLines(lines);
+    if ( *c == ' ' ) c++;
+    *cursor = c;
+    return node;
 }
 
-void doKeyDown(SDL_KeyboardEvent *event) {
-        if ( isEditMode(MODE) ){
-            switch(event->keysym.sym) {
-                case SDLK_BACKSPACE: deleteCharInBufferRelativeToCursor(0); unwritten = 1; return;
-                case SDLK_DELETE:    deleteCharInBufferRelativeToCursor(1); unwritten = 1; return;
-                case SDLK_LEFT:      CURSOR_POSITION = max(CURSOR_POSITION-1,-1); return;
-                case SDLK_RIGHT:     CURSOR_POSITION = min(CURSOR_POSITION+1,CURRENT_BUFFER->len-1); return;
-                case SDLK_UP:        moveCursorLine(-1); return;
-                case SDLK_DOWN:      moveCursorLine(1);  return;
-            }
+static bool journalApply(char* line, FILE* fp){
+    char* cursor = line + 2;
+    char op = line[0];
+    if ( op == '\0' || line[1] != ' ' ) return false;
+    switch ( op ){
+        case 'c': {
+            Node* parent = journalResolve(&cursor);
+            if ( !parent ) return false;
+            attachNode(makeNode(), parent, atoi(cursor));
+            return true;
+        }
+        case 'd': {
+            Node* node = journalResolve(&cursor);
+            if ( !node || node == GRAPH.root ) return false;
+            unlinkNode(node);
+            deleteNode(node);
+            return true;
         }
-        else{
-            switch(event->keysym.sym) {
-                case SDLK_MINUS:     GRAPH_SCALE *= 1/ZOOM_SPEED; return;
-                case SDLK_EQUALS:    GRAPH_SCALE *= ZOOM_SPEED; return;
-                case SDLK_q: APP.quit = true; return;
+        case 'm': {
+            Node* node = journalResolve(&cursor);
+            if ( !node || node == GRAPH.root ) return false;
+            // the destination is named in the tree without the node, so it is unlinked first
+            Node* old_parent = node->p;
+            int old_index = unlinkNode(node);
+            Node* parent = journalResolve(&cursor);
+            if ( !parent ){
+                attachNode(node, old_parent, old_index);
+                return false;
             }
+            attachNode(node, parent, atoi(cursor));
+            return true;
+        }
+        case 't': {
+            Node* node = journalResolve(&cursor);
+            if ( !node ) return false;
+            replaceChar(cursor, '|', '\n');
+            setNodeText(node, cursor);
+            return true;
+        }
+        case 's': {
+            Node* parent = journalResolve(&cursor);
+            int index, num_lines;
+            if ( !parent || sscanf(cursor, "%d %d", &index, &num_lines) != 2 ) return false;
+            Node* subtree = readSubtree(fp, num_lines);
+            if ( !subtree ) return false;
+            attachNode(subtree, parent, index);
+            searchIndexSubtree(subtree);
+            return true;
         }
+    }
+    return false;
 }
 
-void doKeyUp(SDL_KeyboardEvent *event) {
-    if (event->repeat != 0) {
-        return;
+static void journalReplay(char* path){
+    FILE* fp = fopen(path, "r");
+    if ( !fp ) return;
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t line_len;
+    int line_num = 0;
+    while ( (line_len = getline(&line, &cap, fp)) > 0 ){
+        line_num++;
+        endAtNewline(line, line_len);
+        if ( line_num == 1 && line[0] == '#' ) continue;
+        if ( !journalApply(line, fp) ){
+            fprintf(stderr, "%s:%d: ignoring the rest of the journal at a bad record\n", path, line_num);
+            break;
+        }
     }
-    // up-front key-checks that apply to any mode
-    switch(event->keysym.sym) {
-        case SDLK_ESCAPE:
-            if (MODE == Travel) CUT = NULL; // clear cut node on a double escape
-            switchMode(Travel);
-            return;
+    free(line);
+    fclose(fp);
+}
+
+static void journalStart(char* path, unsigned long long base_hash){
+    JOURNAL_FILE = fopen(path, "w");
+    if ( !JOURNAL_FILE ) return;
+    fprintf(JOURNAL_FILE, "# %016llx\n", base_hash);
+    fflush(JOURNAL_FILE);
+    JOURNAL_RECORDS = 0;
+}
+
+// writes through a temporary file so that path always holds a complete version
+static void replaceFileContents(char* path, char* buf, size_t len){
+    FILE* fp = fopen(JOURNAL_TMP_PATH, "w");
+    if ( !fp ) return;
+    fwrite(buf, 1, len, fp);
+    fflush(fp);
+    fsync(fileno(fp));
+    fclose(fp);
+    rename(JOURNAL_TMP_PATH, path);
+}
+
+static int journalCompactThread(void* data){
+    JournalSnapshot* snapshot = data;
+    replaceFileContents(JOURNAL_BASE_PATH, snapshot->buf, snapshot->len);
+    unlink(JOURNAL_OLD_PATH);
+    memFree(MemFiles, snapshot->buf);
+    memFree(MemFiles, snapshot);
+    SDL_AtomicSet(&JOURNAL_COMPACTING, 0);
+    return 0;
+}
+
+static JournalSnapshot* journalSnapshot(){
+    JournalSnapshot* snapshot = memCalloc(MemFiles, 1, sizeof(JournalSnapshot));
+    FILE* stream = open_memstream(&snapshot->buf, &snapshot->len);
+    writeChildrenStrings(stream, GRAPH.root, 0);
+    fclose(stream);
+    memCount(MemFiles, snapshot->buf, 1);
+    return snapshot;
+}
+
+// folds the journal into the base file; in the background unless wait is set
+void journalCompact(bool wait){
+    if ( !JOURNAL_FILE ) return;
+    if ( JOURNAL_THREAD ){
+        if ( SDL_AtomicGet(&JOURNAL_COMPACTING) && !wait ) return;
+        SDL_WaitThread(JOURNAL_THREAD, NULL);
+        JOURNAL_THREAD = NULL;
+    }
+    logPrint("Compacting journal of %d records\n", JOURNAL_RECORDS);
+    // serializing in memory is the only part that has to see a consistent tree
+    JournalSnapshot* snapshot = journalSnapshot();
+
+    // records from here on apply to the snapshot, so they start a fresh journal
+    fclose(JOURNAL_FILE);
+    rename(JOURNAL_PATH, JOURNAL_OLD_PATH);
+    journalStart(JOURNAL_PATH, fnv1a(FNV_OFFSET, snapshot->buf, snapshot->len));
+
+    SDL_AtomicSet(&JOURNAL_COMPACTING, 1);
+    JOURNAL_THREAD = SDL_CreateThread(journalCompactThread, "journal compaction", snapshot);
+    if ( !JOURNAL_THREAD )
+        journalCompactThread(snapshot);
+    else if ( wait ){
+        SDL_WaitThread(JOURNAL_THREAD, NULL);
+        JOURNAL_THREAD = NULL;
+    }
+}
+
+// called from the event loop, between events, when the tree is consistent
+void journalMaybeCompact(){
+    if ( JOURNAL_RECORDS >= JOURNAL_COMPACT_RECORDS )
+        journalCompact(false);
+}
+
+// true if the journal at path was written against a base file with this hash
+static bool journalAppliesTo(char* path, unsigned long long base_hash){
+    FILE* fp = fopen(path, "r");
+    if ( !fp ) return false;
+    unsigned long long journal_hash;
+    bool applies = fscanf(fp, "# %llx", &journal_hash) == 1 && journal_hash == base_hash;
+    fclose(fp);
+    return applies;
+}
+
+// loads FILENAME_BUFFER in journal mode: base file, then the journals that still apply to it
+void journalLoad(){
+    snprintf(JOURNAL_BASE_PATH, sizeof(JOURNAL_BASE_PATH), "%s", FILENAME_BUFFER.buf);
+    snprintf(JOURNAL_PATH, sizeof(JOURNAL_PATH), "%s.journal", JOURNAL_BASE_PATH);
+    snprintf(JOURNAL_OLD_PATH, sizeof(JOURNAL_OLD_PATH), "%s.journal.old", JOURNAL_BASE_PATH);
+    snprintf(JOURNAL_TMP_PATH, sizeof(JOURNAL_TMP_PATH), "%s.tmp", JOURNAL_BASE_PATH);
+    unlink(JOURNAL_TMP_PATH);
+
+    readFile();
+    // journal.old only applies if a compaction died before replacing the base file
+    bool interrupted = journalAppliesTo(JOURNAL_OLD_PATH, FILE_HASH);
+    if ( interrupted ){
+        journalReplay(JOURNAL_OLD_PATH);
+        journalReplay(JOURNAL_PATH);
+    }
+    else if ( journalAppliesTo(JOURNAL_PATH, FILE_HASH) )
+        journalReplay(JOURNAL_PATH);
+
+    if ( interrupted ){
+        // finish the compaction now, before journal.old can be reused
+        JournalSnapshot* snapshot = journalSnapshot();
+        replaceFileContents(JOURNAL_BASE_PATH, snapshot->buf, snapshot->len);
+        FILE_HASH = fnv1a(FNV_OFFSET, snapshot->buf, snapshot->len);
+        memFree(MemFiles, snapshot->buf);
+        memFree(MemFiles, snapshot);
+    }
+    else if ( journalAppliesTo(JOURNAL_PATH, FILE_HASH) ){
+        JOURNAL_FILE = fopen(JOURNAL_PATH, "a");
+        JOURNAL_RECORDS = 0;
+    }
+    unlink(JOURNAL_OLD_PATH);
+    if ( !JOURNAL_FILE )
+        journalStart(JOURNAL_PATH, FILE_HASH);
+    if ( !JOURNAL_FILE )
+        fprintf(stderr, "Couldn't open journal %s, changes are only saved with w\n", JOURNAL_PATH);
+}
+
+void journalSync(){
+    if ( !JOURNAL_FILE ) return;
+    fflush(JOURNAL_FILE);
+    fsync(fileno(JOURNAL_FILE));
+}
+
+// every change is already in the journal, so saving only has to make it durable
+bool journalSave(){
+    if ( !JOURNAL_FILE || strcmp(FILENAME_BUFFER.buf, JOURNAL_BASE_PATH) != 0 )
+        return false;
+    journalSync();
+    unwritten = 0;
+    return true;
+}
+
+void journalClose(){
+    if ( JOURNAL_THREAD ){
+        SDL_WaitThread(JOURNAL_THREAD, NULL);
+        JOURNAL_THREAD = NULL;
     }
+    if ( !JOURNAL_FILE ) return;
+    journalSync();
+    fclose(JOURNAL_FILE);
+    JOURNAL_FILE = NULL;
+}
+
+
+// LAZY LOADING
+
+/* Lazy mode (-l) only materializes the top of the tree. An offset index of
+ * the file, built once and kept next to it in <file>.idx, stores for every
+ * line its byte offset and how many lines its subtree spans. A node whose
+ * children are not all parsed yet remembers the line of the next one in
+ * lazy_next. Selecting a node parses below it breadth first until
+ * LAZY_LOAD_BUDGET nodes have been created, so even very wide nodes are
+ * loaded a chunk at a time. */
+typedef struct LazyIndexHeader LazyIndexHeader;
+struct LazyIndexHeader {
+    char magic[4];
+    unsigned int version;
+    unsigned long long file_size;
+    long long file_mtime;
+    unsigned long long num_lines;
+};
+static bool LAZY_MODE = false;
+static FILE* LAZY_FILE = NULL;                   // the file the index describes
+static unsigned long long LAZY_NUM_LINES = 0;
+static unsigned long long* LAZY_OFFSETS = NULL;  // byte offset of each line
+static unsigned int* LAZY_DESCENDANTS = NULL;    // lines in the subtree below each line
+static void* LAZY_MAP = NULL;                    // mmapped index, if it came from <file>.idx
+static size_t LAZY_MAP_SIZE = 0;
+static Node* LAZY_LAST_SELECTED = NULL;
+static char* LAZY_LINE = NULL;                   // line buffer reused by lazyReadLine
+static size_t LAZY_LINE_SIZE = 0;
+
+static bool lazyMapIndex(char* index_path, struct stat* file_stat){
+    int fd = open(index_path, O_RDONLY);
+    if ( fd < 0 ) return false;
+    struct stat index_stat;
+    LazyIndexHeader* header = NULL;
+    if ( fstat(fd, &index_stat) == 0 && index_stat.st_size >= sizeof(LazyIndexHeader) )
+        header = mmap(NULL, index_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( !header || header == MAP_FAILED ) return false;
+    size_t expected = sizeof(LazyIndexHeader) + header->num_lines * (sizeof(unsigned long long) + sizeof(unsigned int));
+    if ( memcmp(header->magic, "DTIX", 4) != 0 || header->version != 1 ||
+         header->file_size != file_stat->st_size || header->file_mtime != file_stat->st_mtime ||
+         index_stat.st_size != expected ){
+        munmap(header, index_stat.st_size);
+        return false;
+    }
+    LAZY_MAP = header;
+    LAZY_MAP_SIZE = index_stat.st_size;
+    LAZY_NUM_LINES = header->num_lines;
+    LAZY_OFFSETS = (unsigned long long*) (header + 1);
+    LAZY_DESCENDANTS = (unsigned int*) (LAZY_OFFSETS + LAZY_NUM_LINES);
+    return true;
+}
 
-    // mode-specific key-bindings
-    switch(MODE) {
-        case Travel:
-            switch(event->keysym.sym) {
-                case SDLK_o: switchMode(MakeChild); return;
-                case SDLK_e: switchMode(Edit); return;
-                case SDLK_r: switchMode(FilenameEdit); return;
-                case SDLK_x: switchMode(Delete); return;
-                case SDLK_m: switchMode(Cut); return;
-                case SDLK_p: switchMode(Paste); return;
-                case SDLK_s: clearBuffer(&GRAPH.selected->text); switchMode(Edit); return;
-                case SDLK_c: TOGGLE_MODE = true; return;
-                case SDLK_w: writeFile(); return;
-                case SDLK_t: open_node_text(GRAPH.selected);
+// one sequential pass over the file, subtree sizes come from a stack of open lines
+static void lazyBuildIndex(FILE* fp){
+    size_t size = 1024;
+    LAZY_OFFSETS = memMalloc(MemFiles, size * sizeof(unsigned long long));
+    LAZY_DESCENDANTS = memMalloc(MemFiles, size * sizeof(unsigned int));
+    unsigned long long* open_lines = memMalloc(MemFiles, size * sizeof(unsigned long long));
+    unsigned int* open_levels = memMalloc(MemFiles, size * sizeof(unsigned int));
+    size_t num_open = 0, open_size = size;
+
+    char* chunk = memMalloc(MemFiles, 1 << 20);
+    unsigned long long offset = 0, line = 0;
+    unsigned int tabs = 0;
+    bool at_line_start = true, counting_tabs = false;
+    size_t chunk_len;
+    while ( (chunk_len = fread(chunk, 1, 1 << 20, fp)) > 0 ){
+        for (size_t i = 0; i < chunk_len; i++, offset++) {
+            if ( at_line_start ){
+                if ( line == size ){
+                    size *= 2;
+                    LAZY_OFFSETS = memRealloc(MemFiles, LAZY_OFFSETS, size * sizeof(unsigned long long));
+                    LAZY_DESCENDANTS = memRealloc(MemFiles, LAZY_DESCENDANTS, size * sizeof(unsigned int));
+                }
+                LAZY_OFFSETS[line] = offset;
+                at_line_start = false;
+                counting_tabs = true;
+                tabs = 0;
             }
-            break; // end of Travel bindings
-        case Edit:
-            switch(event->keysym.sym) {
-                case SDLK_RETURN:
-                    insertCharIntoCurrentBuffer('\n');
-                    return;
+            if ( counting_tabs && chunk[i] == '\t' )
+                tabs++;
+            else if ( counting_tabs ){
+                counting_tabs = false;
+                // the first line is the root, every other line is at least a child of it
+                unsigned int level = line == 0 ? 0 : max(1, tabs);
+                while ( num_open > 0 && open_levels[num_open-1] >= level ){
+                    num_open--;
+                    LAZY_DESCENDANTS[open_lines[num_open]] = line - open_lines[num_open] - 1;
+                }
+                if ( num_open == open_size ){
+                    open_size *= 2;
+                    open_lines = memRealloc(MemFiles, open_lines, open_size * sizeof(unsigned long long));
+                    open_levels = memRealloc(MemFiles, open_levels, open_size * sizeof(unsigned int));
+                }
+                open_lines[num_open] = line;
+                open_levels[num_open++] = level;
             }
-            break; // end of Edit bindings
-        case Delete:
-            switch(event->keysym.sym) {
-                case SDLK_x: { switchMode(Travel); return; }
+            if ( chunk[i] == '\n' ){
+                line++;
+                at_line_start = true;
             }
-            break; // end of Delete bindings
-        default:
-            break;
+        }
     }
+    if ( !at_line_start ) line++;
+    while ( num_open > 0 ){
+        num_open--;
+        LAZY_DESCENDANTS[open_lines[num_open]] = line - open_lines[num_open] - 1;
+    }
+    LAZY_NUM_LINES = line;
+    memFree(MemFiles, chunk);
+    memFree(MemFiles, open_lines);
+    memFree(MemFiles, open_levels);
 }
 
-void eventHandler(SDL_Event *event) {
-    switch (event->type){
-        case SDL_TEXTINPUT: handleTextInput(event); break;
-        case SDL_KEYDOWN: doKeyDown(&event->key); break;
-        case SDL_KEYUP: doKeyUp(&event->key); break;
-        case SDL_QUIT: exit(0); break;
-        case SDL_WINDOWEVENT:
-            if(event->window.event == SDL_WINDOWEVENT_RESIZED)
-                SDL_GetWindowSize(APP.window, &APP.window_size.x, &APP.window_size.y);
-            break;
-        default:
-            break;
-    }
+static void lazyWriteIndex(char* index_path, struct stat* file_stat){
+    FILE* fp = fopen(index_path, "w");
+    if ( !fp ) return;
+    LazyIndexHeader header = {{'D', 'T', 'I', 'X'}, 1, file_stat->st_size, file_stat->st_mtime, LAZY_NUM_LINES};
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(LAZY_OFFSETS, sizeof(unsigned long long), LAZY_NUM_LINES, fp);
+    fwrite(LAZY_DESCENDANTS, sizeof(unsigned int), LAZY_NUM_LINES, fp);
+    fclose(fp);
 }
 
+// reads a line of the indexed file into LAZY_LINE, without its trailing newline
+static char* lazyReadLine(unsigned long long line){
+    fseek(LAZY_FILE, LAZY_OFFSETS[line], SEEK_SET);
+    ssize_t line_len = getline(&LAZY_LINE, &LAZY_LINE_SIZE, LAZY_FILE);
+    if ( line_len < 0 ) return "";
+    endAtNewline(LAZY_LINE, line_len);
+    replaceChar(LAZY_LINE, '|', '\n');
+    return LAZY_LINE;
+}
 
-// POSITION CALCULATION ALGORITHM
+static void lazySetSubtree(Node* node, unsigned long long line){
+    if ( LAZY_DESCENDANTS[line] == 0 ) return;
+    node->lazy_next = line + 1;
+    node->lazy_end = line + LAZY_DESCENDANTS[line];
+}
 
-// returns the height of the tree with given root node
-int getDepth(Node* node) {
-    int max_depth = 0;
-    for(int i = 0; i < node->children->num; i++) {
-        int child_depth = getDepth(node->children->array[i]);
-        if (max_depth < child_depth) {
-            max_depth = child_depth;
-        }
+// parses up to max_children more children of a node, returns how many were created
+static int lazyLoadChildren(Node* node, int max_children){
+    int loaded = 0;
+    unsigned long long line = node->lazy_next;
+    for (; line <= node->lazy_end && loaded < max_children; line += LAZY_DESCENDANTS[line] + 1, loaded++) {
+        Node* child = makeChild(node);
+        char* text = lazyReadLine(line);
+        loadNodeText(child, text + countTabs(text));
+        searchIndexNode(child);
+        lazySetSubtree(child, line);
     }
-    return 1 + max_depth;
+    node->lazy_next = line <= node->lazy_end ? line : -1;
+    return loaded;
 }
 
-// recursive helper function for calculatePositions
-// shifts over subtrees so that they do not overlap at any x-coordinate
-void calculateOffsets(Node* node) {
+// must run before a node gets new children, so that they end up after the unloaded ones
+void lazyLoadRemaining(Node* node){
+    if ( node->lazy_next >= 0 )
+        lazyLoadChildren(node, node->lazy_end - node->lazy_next + 1);
+}
 
-    logPrint("Calculating offsets for %p...\n", node);
-    int text_pixel_length = getWidth(node->text.buf, true) * GRAPH_SCALE;
-    node -> x_offset  = 0;
-    node -> rightmost = text_pixel_length/2;
-    node -> leftmost  = -text_pixel_length/2;
-    int total_offset = 0;
-    logPrint("Shifting %ld children for node with text %s\n", node->children->num, node->text.buf);
-    for (int i = 0; i < node->children->num; i++) {
-        Node* child = node->children->array[i];
-        calculateOffsets(child);
-        if (i > 0) {
-            // shift the current child (more than) far enough away from the
-            // previous to guarantee that they subtrees will not overlap
-            int offset = (node->children->array[i-1]->rightmost)-(child->leftmost)+RADIUS;
-            total_offset += offset;
-            child->x_offset = total_offset;
-        }
+// loads the subtree below node breadth first until budget nodes have been created
+void lazyExpand(Node* node, int budget){
+    Array* queue = initTaggedArray(16, MemFiles);
+    insertArray(queue, node);
+    for (int i = 0; i < queue->num && budget > 0; i++) {
+        Node* cur = queue->array[i];
+        if ( cur->lazy_next >= 0 )
+            budget -= lazyLoadChildren(cur, budget);
+        for (int j = 0; j < cur->children->num; j++)
+            insertArray(queue, cur->children->array[j]);
     }
-    logPrint("Centering parent\n");
-    // center parent over children
-    for (int i = 0; i < node->children->num; i++) {
-        Node* child = node->children->array[i];
-        child->x_offset -= total_offset/2;
+    freeArray(queue);
+}
+
+// expands the selected node the first time it is navigated into, and
+// loads the next chunk of siblings when the last loaded one is reached
+void lazyFollowSelection(){
+    if ( !LAZY_FILE || GRAPH.selected == LAZY_LAST_SELECTED ) return;
+    LAZY_LAST_SELECTED = GRAPH.selected;
+    Node* parent = GRAPH.selected->p;
+    if ( parent->lazy_next >= 0 && parent->children->array[parent->children->num-1] == GRAPH.selected )
+        lazyLoadChildren(parent, LAZY_LOAD_BUDGET);
+    lazyExpand(GRAPH.selected, LAZY_LOAD_BUDGET);
+}
+
+// opens FILENAME_BUFFER in lazy mode, loading only the first LAZY_LOAD_BUDGET nodes
+void lazyOpen(){
+    LAZY_FILE = fopen(FILENAME_BUFFER.buf, "r");
+    if ( !LAZY_FILE ) return;
+    struct stat file_stat;
+    fstat(fileno(LAZY_FILE), &file_stat);
+    char index_path[FILENAME_MAX + 8];
+    snprintf(index_path, sizeof(index_path), "%s.idx", FILENAME_BUFFER.buf);
+    if ( !lazyMapIndex(index_path, &file_stat) ){
+        lazyBuildIndex(LAZY_FILE);
+        lazyWriteIndex(index_path, &file_stat);
     }
-    // calculate leftmost and rightmost for current node
-    logPrint("Calculating left and rightmost children\n");
-    if(node->children->num >= 1) {
+    if ( LAZY_NUM_LINES == 0 ) return;
+    loadNodeText(GRAPH.root, lazyReadLine(0));
+    searchIndexNode(GRAPH.root);
+    lazySetSubtree(GRAPH.root, 0);
+    LAZY_LAST_SELECTED = GRAPH.root;
+    lazyExpand(GRAPH.root, LAZY_LOAD_BUDGET);
+}
+
+// writes the children of a node that are not loaded yet straight from the
+// source file, re-indented for the level the node is written at
+void lazyWriteDescendants(FILE* file, Node* node, int level){
+    fseek(LAZY_FILE, LAZY_OFFSETS[node->lazy_next], SEEK_SET);
+    int child_tabs = -1;
+    for (long long line = node->lazy_next; line <= node->lazy_end; line++) {
+        ssize_t line_len = getline(&LAZY_LINE, &LAZY_LINE_SIZE, LAZY_FILE);
+        if ( line_len < 0 ) break;
+        int tabs = countTabs(LAZY_LINE);
+        if ( child_tabs < 0 ) child_tabs = tabs;
+        for (int t = 0; t < tabs - child_tabs + level + 1; t++)
+            fputc('\t', file);
+        fputs(LAZY_LINE + tabs, file);
+        if ( LAZY_LINE[line_len-1] != '\n' )
+            fputc('\n', file);
+    }
+}
+
+// like lazyWriteDescendants, for the other outline formats
+void lazySaveDescendants(Saver* saver, Node* node, int level){
+    fseek(LAZY_FILE, LAZY_OFFSETS[node->lazy_next], SEEK_SET);
+    int child_tabs = -1;
+    for (long long line = node->lazy_next; line <= node->lazy_end; line++) {
+        ssize_t line_len = getline(&LAZY_LINE, &LAZY_LINE_SIZE, LAZY_FILE);
+        if ( line_len < 0 ) break;
+        endAtNewline(LAZY_LINE, line_len);
+        replaceChar(LAZY_LINE, '|', '\n');
+        int tabs = countTabs(LAZY_LINE);
+        if ( child_tabs < 0 ) child_tabs = tabs;
+        saverNode(saver, tabs - child_tabs + level + 1, LAZY_LINE + tabs);
+    }
+}
+
+// the unloaded subtrees are copied out of the file being replaced, so write beside it
+bool lazySave(){
+    if ( !LAZY_FILE ) return false;
+    char tmp_path[FILENAME_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", FILENAME_BUFFER.buf);
+    FILE* output = fopen(tmp_path, "w");
+    if ( !output ) return true;
+    saveTree(output, outlineFormat(FILENAME_BUFFER.buf));
+    fclose(output);
+    rename(tmp_path, FILENAME_BUFFER.buf);
+    unwritten = 0;
+    return true;
+}
+
+void lazyClose(){
+    if ( !LAZY_FILE ) return;
+    if ( LAZY_MAP )
+        munmap(LAZY_MAP, LAZY_MAP_SIZE);
+    else {
+        memFree(MemFiles, LAZY_OFFSETS);
+        memFree(MemFiles, LAZY_DESCENDANTS);
+    }
+    free(LAZY_LINE);
+    fclose(LAZY_FILE);
+    LAZY_FILE = NULL;
+}
+
+
+// LIVE RELOAD
+
+/* The open file is watched with inotify, through its directory so that editors which
+ * replace the file by a rename are seen too. When another program rewrites it, a
+ * background thread converts the new version to the native format in memory, links its
+ * lines into a tree of first children and next siblings, and hands the ReloadSnapshot to
+ * the event loop with a RELOAD_EVENT. The event loop then patches the tree to match, as
+ * one undoable step: children are matched to the new lines by position and text, so
+ * unchanged nodes are kept as they are, along with the selection, their hints, the search
+ * index and the layout. If the tree has unsaved changes, Conflict mode asks first whether
+ * to reload or keep them. Writes of our own are recognised by the file's inode, size and
+ * modification time, and ignored. */
+typedef struct ReloadLine ReloadLine;
+struct ReloadLine {
+    char* text;
+    int first;      // line of the first child, -1 for a leaf
+    int next;       // line of the next sibling, -1 for the last child
+};
+
+typedef struct ReloadSnapshot ReloadSnapshot;
+struct ReloadSnapshot {
+    char* buf;                  // the file in the native format, cut into lines in place
+    size_t len;
+    ReloadLine* lines;
+    int num;
+    unsigned long long hash;    // of the file as read, like FILE_HASH
+    struct stat st;
+};
+
+static int RELOAD_FD = -1;
+static int RELOAD_WATCH = -1;
+static char RELOAD_PATH[FILENAME_MAX];      // the watched file
+static char RELOAD_NAME[FILENAME_MAX];      // its name within the watched directory
+static SDL_Thread* RELOAD_THREAD = NULL;
+static SDL_atomic_t RELOAD_QUIT;
+static SDL_mutex* RELOAD_LOCK = NULL;       // guards RELOAD_KNOWN
+static struct stat RELOAD_KNOWN;            // the file as last read, written or reloaded
+static Uint32 RELOAD_EVENT = (Uint32) -1;
+static ReloadSnapshot* RELOAD_PENDING = NULL; // waiting for Travel mode or for a conflict to be settled
+
+static bool reloadSameFile(struct stat* a, struct stat* b){
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size
+        && a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static bool reloadIsKnown(struct stat* st){
+    SDL_LockMutex(RELOAD_LOCK);
+    bool known = reloadSameFile(st, &RELOAD_KNOWN);
+    SDL_UnlockMutex(RELOAD_LOCK);
+    return known;
+}
+
+static void reloadSetKnown(struct stat* st){
+    SDL_LockMutex(RELOAD_LOCK);
+    RELOAD_KNOWN = *st;
+    SDL_UnlockMutex(RELOAD_LOCK);
+}
+
+// remembers the file as it is now, so that the change just made to it is not reloaded
+void reloadRemember(){
+    struct stat st;
+    if ( RELOAD_LOCK && stat(RELOAD_PATH, &st) == 0 )
+        reloadSetKnown(&st);
+}
+
+static void reloadFree(ReloadSnapshot* snapshot){
+    if ( !snapshot ) return;
+    memFree(MemFiles, snapshot->buf);
+    memFree(MemFiles, snapshot->lines);
+    memFree(MemFiles, snapshot);
+}
+
+// reads the watched file into a snapshot; runs on the watcher thread, so touches no tree state
+static ReloadSnapshot* reloadParse(struct stat* st){
+    FILE* fp = fopen(RELOAD_PATH, "r");
+    if ( !fp ) return NULL;
+    ReloadSnapshot* snapshot = memCalloc(MemFiles, 1, sizeof(ReloadSnapshot));
+    snapshot->st = *st;
+    snapshot->hash = FNV_OFFSET;
+    FILE* stream = open_memstream(&snapshot->buf, &snapshot->len);
+    Saver saver;
+    Loader loader;
+    saverBegin(&saver, stream, Native);
+    loaderBegin(&loader, NULL, &saver);
+    importOutline(fp, outlineFormat(RELOAD_PATH), &loader, &snapshot->hash);
+    loaderEnd(&loader);
+    saverEnd(&saver);
+    fclose(stream);
+    fclose(fp);
+    memCount(MemFiles, snapshot->buf, 1);
+
+    // the saver has already clamped the levels, so each line is a child of the last line one level up
+    int size = 1024, depth = 0, levels = 64;
+    int* last = memMalloc(MemFiles, levels * sizeof(int));  // last line on each level of the current path
+    snapshot->lines = memMalloc(MemFiles, size * sizeof(ReloadLine));
+    for (char* line = snapshot->buf; line < snapshot->buf + snapshot->len; ) {
+        char* end = strchr(line, '\n');
+        if ( end ) *end = '\0';
+        int level = countTabs(line);
+        if ( snapshot->num == size ){
+            size *= 2;
+            snapshot->lines = memRealloc(MemFiles, snapshot->lines, size * sizeof(ReloadLine));
+        }
+        if ( level == levels ){
+            levels *= 2;
+            last = memRealloc(MemFiles, last, levels * sizeof(int));
+        }
+        ReloadLine* cur = &snapshot->lines[snapshot->num];
+        cur->text = line + level;
+        cur->first = cur->next = -1;
+        replaceChar(cur->text, '|', '\n');
+        if ( level > 0 && level < depth )
+            snapshot->lines[last[level]].next = snapshot->num;
+        else if ( level > 0 )
+            snapshot->lines[last[level-1]].first = snapshot->num;
+        last[level] = snapshot->num++;
+        depth = level + 1;
+        line = end ? end + 1 : snapshot->buf + snapshot->len;
+    }
+    memFree(MemFiles, last);
+    return snapshot;
+}
+
+static int reloadThread(void* data){
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while ( !SDL_AtomicGet(&RELOAD_QUIT) ){
+        ssize_t len = read(RELOAD_FD, events, sizeof(events));
+        if ( len <= 0 ){
+            if ( len < 0 && errno == EINTR ) continue;
+            break;
+        }
+        bool changed = false;
+        for (char* p = events; p < events + len; ) {
+            struct inotify_event* event = (struct inotify_event*) p;
+            if ( event->len && strcmp(event->name, RELOAD_NAME) == 0 )
+                changed = true;
+            p += sizeof(struct inotify_event) + event->len;
+        }
+        struct stat st;
+        if ( !changed || SDL_AtomicGet(&RELOAD_QUIT) || stat(RELOAD_PATH, &st) != 0 || reloadIsKnown(&st) )
+            continue;
+        ReloadSnapshot* snapshot = reloadParse(&st);
+        if ( !snapshot ) continue;
+        SDL_Event event;
+        memset(&event, 0, sizeof(event));
+        event.type = RELOAD_EVENT;
+        event.user.data1 = snapshot;
+        if ( SDL_PushEvent(&event) != 1 )
+            reloadFree(snapshot);
+    }
+    return 0;
+}
+
+// starts watching FILENAME_BUFFER for changes made by other programs
+void reloadWatch(){
+    snprintf(RELOAD_PATH, sizeof(RELOAD_PATH), "%s", FILENAME_BUFFER.buf);
+    char dir[FILENAME_MAX];
+    char* slash = strrchr(RELOAD_PATH, '/');
+    if ( slash ){
+        snprintf(dir, sizeof(dir), "%.*s", slash == RELOAD_PATH ? 1 : (int) (slash - RELOAD_PATH), RELOAD_PATH);
+        snprintf(RELOAD_NAME, sizeof(RELOAD_NAME), "%s", slash + 1);
+    }
+    else {
+        strcpy(dir, ".");
+        snprintf(RELOAD_NAME, sizeof(RELOAD_NAME), "%s", RELOAD_PATH);
+    }
+    RELOAD_EVENT = SDL_RegisterEvents(1);
+    RELOAD_FD = RELOAD_EVENT == (Uint32) -1 ? -1 : inotify_init1(IN_CLOEXEC);
+    if ( RELOAD_FD >= 0 )
+        RELOAD_WATCH = inotify_add_watch(RELOAD_FD, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+    if ( RELOAD_WATCH < 0 ){
+        fprintf(stderr, "Could not watch %s for changes: %s\n", RELOAD_PATH, strerror(errno));
+        if ( RELOAD_FD >= 0 ) close(RELOAD_FD);
+        RELOAD_FD = -1;
+        return;
+    }
+    RELOAD_LOCK = SDL_CreateMutex();
+    reloadRemember();
+    SDL_AtomicSet(&RELOAD_QUIT, 0);
+    RELOAD_THREAD = SDL_CreateThread(reloadThread, "live reload", NULL);
+}
+
+// takes a snapshot from a RELOAD_EVENT, replacing any older one still waiting
+void reloadReceive(ReloadSnapshot* snapshot){
+    // a new name from FilenameEdit means the watched file is no longer the one being edited
+    if ( reloadIsKnown(&snapshot->st) || strcmp(FILENAME_BUFFER.buf, RELOAD_PATH) != 0 ){
+        reloadFree(snapshot);
+        return;
+    }
+    reloadFree(RELOAD_PENDING);
+    RELOAD_PENDING = snapshot;
+}
+
+static bool reloadTextEquals(Node* node, char* text){
+    size_t len = strnlen(text, MAX_TEXT_LEN - 1);
+    return node->text.len == len && memcmp(node->text.buf, text, len) == 0;
+}
+
+static void reloadPatchText(Node* node, char* text){
+    if ( reloadTextEquals(node, text) ) return;
+    undoBeginTextEdit(node);
+    setNodeText(node, text);
+    undoEndTextEdit();
+}
+
+// index of the first of the next few children of parent after index with this text, or -1
+static int reloadFindChild(Node* parent, int index, char* text){
+    int end = min(parent->children->num, index + 1 + RELOAD_MATCH_WINDOW);
+    for (int i = index + 1; i < end; i++)
+        if ( reloadTextEquals(parent->children->array[i], text) )
+            return i;
+    return -1;
+}
+
+// true if one of the next few siblings of line has the text of node
+static bool reloadFindLine(ReloadLine* lines, int line, Node* node){
+    int k = lines[line].next;
+    for (int i = 0; k >= 0 && i < RELOAD_MATCH_WINDOW; i++, k = lines[k].next)
+        if ( reloadTextEquals(node, lines[k].text) )
+            return true;
+    return false;
+}
+
+typedef struct ReloadPair ReloadPair;
+struct ReloadPair {
+    Node* node;
+    int line;
+};
+
+// patches the tree to match the snapshot, touching only the nodes that differ
+static void reloadPatch(ReloadSnapshot* snapshot){
+    ReloadLine* lines = snapshot->lines;
+    int size = 64, top = 0;
+    ReloadPair* stack = memMalloc(MemOther, size * sizeof(ReloadPair));
+    reloadPatchText(GRAPH.root, lines[0].text);
+    stack[top++] = (ReloadPair) {GRAPH.root, 0};
+    while ( top > 0 ){
+        ReloadPair pair = stack[--top];
+        Node* parent = pair.node;
+        int i = 0;
+        for (int k = lines[pair.line].first; k >= 0 || i < parent->children->num; ) {
+            Node* child = i < parent->children->num ? parent->children->array[i] : NULL;
+            if ( k < 0 ){
+                removeNodeFromGraph(child);
+                continue;
+            }
+            if ( child && !reloadTextEquals(child, lines[k].text) ){
+                // children removed: drop them up to the one that matches this line
+                int found = reloadFindChild(parent, i, lines[k].text);
+                if ( found > i ){
+                    for (int n = found - i; n > 0; n--)
+                        removeNodeFromGraph(parent->children->array[i]);
+                    continue;
+                }
+                // lines inserted before the child are created, anything else is edited in place
+                if ( reloadFindLine(lines, k, child) )
+                    child = NULL;
+                else
+                    reloadPatchText(child, lines[k].text);
+            }
+            if ( !child ){
+                child = makeNode();
+                loadNodeText(child, lines[k].text);
+                attachNode(child, parent, i);
+                searchIndexNode(child);
+                undoRecordCreate(child);
+            }
+            if ( top == size ){
+                size *= 2;
+                stack = memRealloc(MemOther, stack, size * sizeof(ReloadPair));
+            }
+            stack[top++] = (ReloadPair) {child, k};
+            i++;
+            k = lines[k].next;
+        }
+    }
+    memFree(MemOther, stack);
+}
+
+// brings the tree in line with the pending snapshot, as one undoable change
+void reloadApply(){
+    ReloadSnapshot* snapshot = RELOAD_PENDING;
+    if ( !snapshot ) return;
+    RELOAD_PENDING = NULL;
+    // a file caught empty is more likely being written than meant to be
+    if ( snapshot->num ){
+        logPrint("Reloading %s\n", RELOAD_PATH);
+        undoBeginBatch();
+        reloadPatch(snapshot);
+        undoEndBatch();
+        FILE_HASH = snapshot->hash;
+        unwritten = 0;
+    }
+    reloadSetKnown(&snapshot->st);
+    reloadFree(snapshot);
+    calculatePositions(GRAPH.root, GRAPH.selected);
+    if ( isHintMode(MODE) )
+        populateHintText(GRAPH.selected);
+}
+
+// the pending change is not loaded, and is not asked about again
+void reloadKeep(){
+    if ( !RELOAD_PENDING ) return;
+    reloadSetKnown(&RELOAD_PENDING->st);
+    reloadFree(RELOAD_PENDING);
+    RELOAD_PENDING = NULL;
+}
+
+// called from the event loop, between events; unsaved changes are not overwritten without asking
+void reloadMaybeApply(){
+    if ( !RELOAD_PENDING || MODE != Travel ) return;
+    if ( unwritten )
+        switchMode(Conflict);
+    else
+        reloadApply();
+}
+
+void reloadClose(){
+    if ( RELOAD_THREAD ){
+        // removing the watch queues an IN_IGNORED event, which wakes the thread up
+        SDL_AtomicSet(&RELOAD_QUIT, 1);
+        inotify_rm_watch(RELOAD_FD, RELOAD_WATCH);
+        SDL_WaitThread(RELOAD_THREAD, NULL);
+        RELOAD_THREAD = NULL;
+    }
+    if ( RELOAD_FD >= 0 ) close(RELOAD_FD);
+    RELOAD_FD = -1;
+    reloadFree(RELOAD_PENDING);
+    RELOAD_PENDING = NULL;
+    if ( RELOAD_LOCK ) SDL_DestroyMutex(RELOAD_LOCK);
+    RELOAD_LOCK = NULL;
+}
+
+
+// HINT MANAGEMENT
+
+/* Hint labels stay on their nodes for as long as the nodes stay on screen.
+ * Labels come from a pool of prefix-free strings, shortest first; a node
+ * that was labelled in the previous pass keeps its label, and only nodes
+ * that come into view take free labels. The pool is only rebuilt, and every
+ * label reassigned, when the nodes on screen outgrow it or shrink to well
+ * below it. */
+static char** HINT_LABELS;          // the pool, a window into HINT_TEXT_QUEUE
+static int HINT_LABEL_COUNT = 0;
+static Node** HINT_LABEL_OWNER;     // node holding each label in the current pass
+static unsigned int HINT_STAMP = 0; // bumped every pass, see Node.hint_stamp
+
+// the first (direction 1) or last (-1) descendant of node that is depth levels below it
+static Node* descendantAtDepth(Node* node, int depth, int direction){
+    Node* found = NULL;
+    Walk walk;
+    walkBegin(&walk, node);
+    walk.reverse = direction < 0;
+    walk.max_level = depth;
+    for (Node* cur; !found && (cur = walkNext(&walk)); )
+        if ( walk.pre && walk.level == depth )
+            found = cur;
+    walkEnd(&walk);
+    return found;
+}
+
+// the nearest node on the same level to the left (direction -1) or right (1) of selected
+static Node* neighborOf(Node* selected, int direction){
+    int depth = 0;
+    for (Node* node = selected; node != GRAPH.root; node = node->p, depth++) {
+        Array* siblings = node->p->children;
+        for (int i = childIndex(node) + direction; i >= 0 && i < siblings->num; i += direction) {
+            Node* found = descendantAtDepth(siblings->array[i], depth, direction);
+            if ( found ) return found;
+        }
+    }
+    return NULL;
+}
+
+// walks up and across from the selected node instead of searching the tree breadth first
+void calculateNeighbors(Node* root, Node* selected) {
+    LEFT_NEIGHBOR = RIGHT_NEIGHBOR = NULL;
+    if (selected == root)
+       return;
+    LEFT_NEIGHBOR = neighborOf(selected, -1);
+    RIGHT_NEIGHBOR = neighborOf(selected, 1);
+}
+
+// forgets the current hint targets; nodes keep their labels for the next pass
+void clearHintText() {
+    HINT_NODES->num = 0;
+}
+
+// the first count labels of the breadth first enumeration over the unreserved hint chars
+static void hintBuildPool(int count){
+    char* prefix = "";
+    int front = 0, back = 0;
+    while ( back - front < count ){
+        for (int i = 0; HINT_CHARS[i] && back - front < count; ++i) {
+            // blacklist hard-coded hints
+            if (HINT_CHARS[i] == 'k' || HINT_CHARS[i] == 'h' || HINT_CHARS[i] == 'l' || HINT_CHARS[i] == 'j')
+                continue;
+            size_t len = strlen(prefix);
+            memcpy(HINT_TEXT_QUEUE[back], prefix, len);
+            HINT_TEXT_QUEUE[back][len] = HINT_CHARS[i];
+            HINT_TEXT_QUEUE[back][len + 1] = '\0';
+            back++;
+        }
+        if ( back - front < count )
+            prefix = HINT_TEXT_QUEUE[front++];
+    }
+    HINT_LABELS = HINT_TEXT_QUEUE + front;
+    HINT_LABEL_COUNT = count;
+}
+
+// most labels that fit in the hint buffer
+static int hintMaxLabels(){
+    int chars = 0, labels = 1;
+    for (int i = 0; HINT_CHARS[i]; i++)
+        chars += !strchr("hjkl", HINT_CHARS[i]);
+    for (int i = 0; i < HINT_BUFFER_MAX_SIZE; i++)
+        labels *= chars;
+    return labels;
+}
+
+static bool hintIsReserved(Node* node){
+    return MODE != SearchJump && (node == GRAPH.selected || node == GRAPH.selected->p
+                                  || node == LEFT_NEIGHBOR || node == RIGHT_NEIGHBOR);
+}
+
+// adds a target once per pass; targets labelled in the previous pass reclaim their label right away
+static void hintAddTarget(Node* node, unsigned int previous){
+    if ( node->hint_stamp == HINT_STAMP ) return;
+    bool kept = node->hint_stamp == previous;
+    node->hint_stamp = HINT_STAMP;
+    insertArray(HINT_NODES, node);
+    if ( kept && !hintIsReserved(node) && node->hint_label >= 0 && node->hint_label < HINT_LABEL_COUNT
+         && !HINT_LABEL_OWNER[node->hint_label] )
+        HINT_LABEL_OWNER[node->hint_label] = node;
+}
+
+// Add a node to HINT_NODES if it is visible
+static void populateHintNode(Node* node){
+    unsigned int previous = HINT_STAMP - 1;
+    if ( node == GRAPH.selected->p ) hintAddTarget(node, previous);
+    logPrint("Adding hint node: %dx%d\n", node->pos.x, node->pos.y);
+    if (-(2*getWidth(node->text.buf, true)) <= node->pos.x &&
+        node->pos.x < APP.window_size.x+(2*getWidth(node->text.buf, true)) &&
+        RADIUS < node->pos.y &&
+        node->pos.y < APP.window_size.y+(2*nodeTextHeight(node->text.buf))) {
+        hintAddTarget(node, previous);
+    }
+}
+
+// Add all visible nodes to HINT_NODES
+void populateHintNodes(Node* node){
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); )
+        if ( walk.pre )
+            populateHintNode(cur);
+    walkEnd(&walk);
+}
+
+void populateHintText(Node* node){
+    logPrint("Populate start\n");
+    if ( !HINT_LABEL_OWNER ){
+        HINT_LABEL_OWNER = memCalloc(MemHints, hintMaxLabels(), sizeof(Node*));
+        hintBuildPool(1);
+    }
+    memset(HINT_LABEL_OWNER, 0, HINT_LABEL_COUNT * sizeof(Node*));
+    clearHintText();
+    HINT_STAMP++;
+    unsigned int previous = HINT_STAMP - 1;
+    if ( MODE == SearchJump ){
+        // search results are the only targets, wherever they are on screen
+        LEFT_NEIGHBOR = RIGHT_NEIGHBOR = NULL;
+        for (int i = 0; i < SEARCH_RESULTS->num; i++)
+            hintAddTarget(SEARCH_RESULTS->array[i], previous);
+    }
+    else {
+        calculateNeighbors(GRAPH.root, GRAPH.selected);
+        if(LEFT_NEIGHBOR) hintAddTarget(LEFT_NEIGHBOR, previous);
+        if(RIGHT_NEIGHBOR) hintAddTarget(RIGHT_NEIGHBOR, previous);
+        populateHintNodes(GRAPH.root);
+    }
+    logPrint("Hint Nodes Populated\n");
+
+    int needed = 0;
+    for (int i = 0; i < HINT_NODES->num; i++)
+        needed += !hintIsReserved(HINT_NODES->array[i]);
+    // rebuild with some room to spare, so that nodes scrolling into view do not reshuffle everything
+    if ( needed > HINT_LABEL_COUNT || needed * 4 < HINT_LABEL_COUNT ){
+        hintBuildPool(min(hintMaxLabels(), needed + needed / 4 + 1));
+        memset(HINT_LABEL_OWNER, 0, HINT_LABEL_COUNT * sizeof(Node*));
+    }
+
+    int next_free = 0;
+    for (int i = 0; i < HINT_NODES->num; i++) {
+        Node* target = HINT_NODES->array[i];
+        if ( hintIsReserved(target) ) continue;
+        if ( target->hint_label >= 0 && target->hint_label < HINT_LABEL_COUNT
+             && HINT_LABEL_OWNER[target->hint_label] == target ){
+            strcpy(target->hint_text, HINT_LABELS[target->hint_label]);
+            continue;
+        }
+        while ( next_free < HINT_LABEL_COUNT && HINT_LABEL_OWNER[next_free] )
+            next_free++;
+        if ( next_free < HINT_LABEL_COUNT ){
+            HINT_LABEL_OWNER[next_free] = target;
+            target->hint_label = next_free;
+            strcpy(target->hint_text, HINT_LABELS[next_free]);
+        }
+        else
+            target->hint_text[0] = '\0';
+    }
+
+    if ( MODE == SearchJump ) return;
+    // parent is 'k', left neighbor 'h', right neighbor 'l'
+    strcpy(node->p->hint_text,"k");
+    strcpy(node->hint_text,"j");
+    if (LEFT_NEIGHBOR)
+        strcpy(LEFT_NEIGHBOR->hint_text, "h");
+    if (RIGHT_NEIGHBOR)
+        strcpy(RIGHT_NEIGHBOR->hint_text, "l");
+    logPrint("Populate end.\n");
+}
+
+
+// SEARCH
+
+/* Trigram inverted index over node text. Every lowercase trigram of an indexed
+ * node's text maps to a posting list of (slot id, version) pairs. Editing a
+ * node only marks it dirty; dirty nodes are re-indexed under a new version
+ * right before the next query, which leaves their old postings stale. Stale
+ * and deleted entries are dropped lazily whenever a posting list is scanned
+ * in full or has to grow. */
+typedef struct SearchPosting SearchPosting;
+typedef struct SearchList SearchList;
+typedef struct SearchSlot SearchSlot;
+struct SearchPosting {
+    unsigned int id;
+    unsigned int version;
+};
+struct SearchList {
+    unsigned int trigram; /* 0 marks an empty hash table entry */
+    unsigned int num;
+    unsigned int size;
+    SearchPosting* postings;
+};
+struct SearchSlot {
+    Node* node;           /* NULL once the node has been deleted */
+    unsigned int version; /* version of the node's current postings */
+};
+static SearchList* SEARCH_TABLE = NULL;   // open addressing, keyed by trigram
+static unsigned int SEARCH_TABLE_SIZE = 0;
+static unsigned int SEARCH_TABLE_NUM = 0;
+static SearchSlot* SEARCH_SLOTS = NULL;   // slot id -> node, slot 0 is unused
+static unsigned int SEARCH_SLOTS_NUM = 1;
+static unsigned int SEARCH_SLOTS_SIZE = 0;
+static unsigned int* SEARCH_FREE_SLOTS = NULL;
+static unsigned int SEARCH_FREE_NUM = 0;
+static unsigned int SEARCH_VERSION = 0;
+static Array* SEARCH_DIRTY = NULL;        // nodes edited since the last flush
+static char SEARCH_LAST_QUERY[64];        // query that produced SEARCH_RESULTS
+static bool SEARCH_RESULTS_COMPLETE = false; // false if results were capped
+
+static unsigned int searchTrigram(char* s){
+    return ((unsigned int) tolower((unsigned char) s[0]) << 16) |
+           ((unsigned int) tolower((unsigned char) s[1]) << 8) |
+            (unsigned int) tolower((unsigned char) s[2]);
+}
+
+static unsigned int searchHash(unsigned int trigram){
+    return (trigram * 2654435761u) & (SEARCH_TABLE_SIZE - 1);
+}
+
+// returns the posting list of a trigram, creating it if create is set
+static SearchList* searchGetList(unsigned int trigram, bool create){
+    if ( SEARCH_TABLE_SIZE == 0 ){
+        if ( !create ) return NULL;
+        SEARCH_TABLE_SIZE = 1024;
+        SEARCH_TABLE = memCalloc(MemSearch, SEARCH_TABLE_SIZE, sizeof(SearchList));
+    }
+    if ( create && (SEARCH_TABLE_NUM + 1) * 10 > SEARCH_TABLE_SIZE * 7 ){
+        // grow and rehash at 70% load
+        SearchList* old = SEARCH_TABLE;
+        unsigned int old_size = SEARCH_TABLE_SIZE;
+        SEARCH_TABLE_SIZE *= 2;
+        SEARCH_TABLE = memCalloc(MemSearch, SEARCH_TABLE_SIZE, sizeof(SearchList));
+        for (unsigned int i = 0; i < old_size; i++) {
+            if ( !old[i].trigram ) continue;
+            unsigned int h = searchHash(old[i].trigram);
+            while ( SEARCH_TABLE[h].trigram )
+                h = (h + 1) & (SEARCH_TABLE_SIZE - 1);
+            SEARCH_TABLE[h] = old[i];
+        }
+        memFree(MemSearch, old);
+    }
+    unsigned int h = searchHash(trigram);
+    while ( SEARCH_TABLE[h].trigram ){
+        if ( SEARCH_TABLE[h].trigram == trigram )
+            return &SEARCH_TABLE[h];
+        h = (h + 1) & (SEARCH_TABLE_SIZE - 1);
+    }
+    if ( !create ) return NULL;
+    SEARCH_TABLE[h].trigram = trigram;
+    SEARCH_TABLE_NUM++;
+    return &SEARCH_TABLE[h];
+}
+
+static bool searchPostingIsLive(SearchPosting posting){
+    return SEARCH_SLOTS[posting.id].node && SEARCH_SLOTS[posting.id].version == posting.version;
+}
+
+// drops postings of deleted nodes and of superseded versions
+static void searchCompactList(SearchList* list){
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < list->num; i++)
+        if ( searchPostingIsLive(list->postings[i]) )
+            list->postings[kept++] = list->postings[i];
+    list->num = kept;
+}
+
+static void searchAppendPosting(SearchList* list, SearchPosting posting){
+    if ( list->num == list->size ){
+        searchCompactList(list);
+        // only grow if compaction did not free at least a quarter of the list
+        if ( list->num * 4 > list->size * 3 || list->size == 0 ){
+            list->size = list->size ? list->size * 2 : 4;
+            list->postings = memRealloc(MemSearch, list->postings, list->size * sizeof(SearchPosting));
+        }
+    }
+    list->postings[list->num++] = posting;
+}
+
+static unsigned int searchAllocSlot(Node* node){
+    unsigned int id;
+    if ( SEARCH_FREE_NUM > 0 )
+        id = SEARCH_FREE_SLOTS[--SEARCH_FREE_NUM];
+    else {
+        if ( SEARCH_SLOTS_NUM >= SEARCH_SLOTS_SIZE ){
+            SEARCH_SLOTS_SIZE = SEARCH_SLOTS_SIZE ? SEARCH_SLOTS_SIZE * 2 : 1024;
+            SEARCH_SLOTS = memRealloc(MemSearch, SEARCH_SLOTS, SEARCH_SLOTS_SIZE * sizeof(SearchSlot));
+            SEARCH_FREE_SLOTS = memRealloc(MemSearch, SEARCH_FREE_SLOTS, SEARCH_SLOTS_SIZE * sizeof(unsigned int));
+        }
+        id = SEARCH_SLOTS_NUM++;
+    }
+    SEARCH_SLOTS[id].node = node;
+    SEARCH_SLOTS[id].version = 0;
+    return id;
+}
+
+// (re-)indexes the current text of a node, superseding its previous postings
+void searchIndexNode(Node* node){
+    if ( node->search_id == 0 ){
+        if ( node->text.len < 3 ) return;
+        node->search_id = searchAllocSlot(node);
+    }
+    SearchSlot* slot = &SEARCH_SLOTS[node->search_id];
+    slot->version = ++SEARCH_VERSION;
+    SearchPosting posting = {node->search_id, slot->version};
+    for (int i = 0; i + 2 < node->text.len; i++)
+        searchAppendPosting(searchGetList(searchTrigram(node->text.buf + i), true), posting);
+}
+
+// called by the edit functions; the node is re-indexed lazily by searchFlushDirty
+void searchMarkDirty(Node* node){
+    if ( !node || node->search_dirty ) return;
+    if ( !SEARCH_DIRTY ) SEARCH_DIRTY = initTaggedArray(8, MemSearch);
+    node->search_dirty = true;
+    insertArray(SEARCH_DIRTY, node);
+}
+
+// called by deleteNode, invalidates every posting of the node in O(1)
+void searchForgetNode(Node* node){
+    if ( node->search_dirty ){
+        removeFromArray(SEARCH_DIRTY, node);
+        node->search_dirty = false;
+    }
+    if ( node->search_id ){
+        SEARCH_SLOTS[node->search_id].node = NULL;
+        SEARCH_FREE_SLOTS[SEARCH_FREE_NUM++] = node->search_id;
+        node->search_id = 0;
+    }
+    if ( SEARCH_RESULTS && node->search_mark == SEARCH_STAMP )
+        removeFromArray(SEARCH_RESULTS, node);
+}
+
+void searchFlushDirty(){
+    if ( !SEARCH_DIRTY ) return;
+    for (int i = 0; i < SEARCH_DIRTY->num; i++) {
+        Node* node = SEARCH_DIRTY->array[i];
+        node->search_dirty = false;
+        searchIndexNode(node);
+    }
+    SEARCH_DIRTY->num = 0;
+}
+
+// case-insensitive substring test, needle must already be lowercase
+static bool containsIgnoreCase(char* haystack, char* needle){
+    for (char* start = haystack; *start; start++) {
+        int i = 0;
+        while ( needle[i] && tolower((unsigned char) start[i]) == needle[i] )
+            i++;
+        if ( !needle[i] ) return true;
+    }
+    return !*needle;
+}
+
+static bool searchAddResult(Node* node, char* query){
+    if ( node->search_mark == SEARCH_STAMP || !containsIgnoreCase(node->text.buf, query) )
+        return false;
+    node->search_mark = SEARCH_STAMP;
+    insertArray(SEARCH_RESULTS, node);
+    return SEARCH_RESULTS->num >= SEARCH_MAX_RESULTS;
+}
+
+// queries shorter than a trigram fall back to a scan that stops at the first page of hits
+static bool searchScanSubtree(Node* node, char* query){
+    bool full = false;
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; !full && (cur = walkNext(&walk)); )
+        full = walk.pre && searchAddResult(cur, query);
+    walkEnd(&walk);
+    return full;
+}
+
+void searchClearResults(){
+    SEARCH_STAMP++;
+    SEARCH_LAST_QUERY[0] = '\0';
+    SEARCH_RESULTS_COMPLETE = false;
+    if ( SEARCH_RESULTS ) SEARCH_RESULTS->num = 0;
+}
+
+void searchQuery(char* raw_query){
+    if ( !SEARCH_RESULTS ) SEARCH_RESULTS = initTaggedArray(SEARCH_MAX_RESULTS, MemSearch);
+    char query[sizeof(SEARCH_LAST_QUERY)];
+    int len = 0;
+    for (; raw_query[len] && len < (int) sizeof(query) - 1; len++)
+        query[len] = tolower((unsigned char) raw_query[len]);
+    query[len] = '\0';
+
+    /* search-as-you-type: a query that extends the previous one can only
+     * match a subset of the previous (uncapped) results */
+    bool refine = SEARCH_RESULTS_COMPLETE && SEARCH_LAST_QUERY[0] && strstr(query, SEARCH_LAST_QUERY);
+    Array* previous = NULL;
+    if ( refine ){
+        previous = initTaggedArray(SEARCH_RESULTS->num + 1, MemSearch);
+        for (int i = 0; i < SEARCH_RESULTS->num; i++)
+            insertArray(previous, SEARCH_RESULTS->array[i]);
+    }
+    searchClearResults();
+    strcpy(SEARCH_LAST_QUERY, query);
+    if ( len == 0 ){
+        SEARCH_LAST_QUERY[0] = '\0';
+        return;
+    }
+    searchFlushDirty();
+
+    if ( refine ){
+        for (int i = 0; i < previous->num; i++)
+            searchAddResult(previous->array[i], query);
+        freeArray(previous);
+        SEARCH_RESULTS_COMPLETE = true;
+        return;
+    }
+    if ( len < 3 ){
+        SEARCH_RESULTS_COMPLETE = !searchScanSubtree(GRAPH.root, query);
+        return;
+    }
+
+    // every trigram of the query must be present; scan the rarest one
+    SearchList* rarest = NULL;
+    for (int i = 0; i + 2 < len; i++) {
+        SearchList* list = searchGetList(searchTrigram(query + i), false);
+        if ( !list ){
+            SEARCH_RESULTS_COMPLETE = true;
+            return;
+        }
+        if ( !rarest || list->num < rarest->num )
+            rarest = list;
+    }
+    unsigned int stale = 0;
+    bool capped = false;
+    for (unsigned int i = 0; i < rarest->num && !capped; i++) {
+        if ( !searchPostingIsLive(rarest->postings[i]) ){
+            stale++;
+            continue;
+        }
+        capped = searchAddResult(SEARCH_SLOTS[rarest->postings[i].id].node, query);
+    }
+    if ( !capped && stale * 2 > rarest->num )
+        searchCompactList(rarest);
+    SEARCH_RESULTS_COMPLETE = !capped;
+}
+
+// re-runs the query in SEARCH_BUFFER, called after each keystroke in Search mode
+void searchUpdate(){
+    searchQuery(SEARCH_BUFFER.buf);
+}
+
+// used when a subtree is detached or re-attached by delete/undo/redo
+void searchIndexSubtree(Node* node){
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); )
+        if ( walk.pre )
+            searchIndexNode(cur);
+    walkEnd(&walk);
+}
+
+void searchForgetSubtree(Node* node){
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); )
+        if ( walk.pre )
+            searchForgetNode(cur);
+    walkEnd(&walk);
+}
+
+
+// UNDO
+
+/* Undo log of inverse operations. Every structural change and every Edit
+ * session pushes one record, and undoing or redoing a record only touches
+ * the nodes it names. Deleted subtrees are detached rather than freed and
+ * belong to their delete record until it drops out of the log; nodes created
+ * by an undone MakeChild belong to the redo stack the same way. */
+enum UndoKind {UndoCreate, UndoDelete, UndoMove, UndoText};
+typedef struct UndoRecord UndoRecord;
+struct UndoRecord {
+    enum UndoKind kind;
+    UndoRecord* older;
+    UndoRecord* newer;
+    Node* node;
+    Node* parent;      /* parent before the operation, or of the created node */
+    int index;         /* index among the parent's children */
+    Node* new_parent;  /* UndoMove only */
+    int new_index;
+    char* old_text;    /* UndoText only */
+    char* new_text;
+    size_t bytes;      /* memory accounted against UNDO_MEMORY_BUDGET */
+    bool with_older;   /* undone and redone together with the record before it */
+};
+static UndoRecord* UNDO_OLDEST = NULL;
+static UndoRecord* UNDO_NEWEST = NULL;   // next record to undo
+static UndoRecord* REDO_NEWEST = NULL;   // next record to redo, linked through older
+static size_t UNDO_BYTES = 0;            // bytes held by records that can be undone
+static Node* UNDO_EDIT_NODE = NULL;      // node of the open Edit session
+static char* UNDO_EDIT_TEXT = NULL;      // its text when the session began
+static int UNDO_BATCH = -1;              // records pushed since undoBeginBatch, -1 outside a batch
+
+// approximate heap footprint of a subtree, used to charge detached subtrees to the budget
+static size_t subtreeBytes(Node* node){
+    size_t bytes = 0;
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); )
+        if ( walk.pre )
+            bytes += sizeof(Node) + sizeof(Array) + cur->children->size * sizeof(Node*) + (nodeTextInline(cur) ? 0 : cur->text.len + 1);
+    walkEnd(&walk);
+    return bytes;
+}
+
+// done tells whether the record is currently applied, which decides what it owns
+static void undoFreeRecord(UndoRecord* record, bool done){
+    if ( done && record->kind == UndoDelete )
+        deleteNode(record->node);
+    if ( !done && record->kind == UndoCreate )
+        deleteNode(record->node);
+    memFree(MemUndo, record->old_text);
+    memFree(MemUndo, record->new_text);
+    memFree(MemUndo, record);
+}
+
+static void undoTrimToBudget(){
+    while ( UNDO_OLDEST && UNDO_BYTES > UNDO_MEMORY_BUDGET ){
+        UndoRecord* oldest = UNDO_OLDEST;
+        UNDO_OLDEST = oldest->newer;
+        if ( UNDO_OLDEST ) UNDO_OLDEST->older = NULL;
+        else UNDO_NEWEST = NULL;
+        UNDO_BYTES -= oldest->bytes;
+        undoFreeRecord(oldest, true);
+    }
+}
+
+static void undoLinkNewest(UndoRecord* record){
+    record->older = UNDO_NEWEST;
+    record->newer = NULL;
+    if ( UNDO_NEWEST ) UNDO_NEWEST->newer = record;
+    else UNDO_OLDEST = record;
+    UNDO_NEWEST = record;
+    UNDO_BYTES += record->bytes;
+}
+
+static UndoRecord* undoPush(enum UndoKind kind, Node* node){
+    // a new operation invalidates everything that could be redone
+    while ( REDO_NEWEST ){
+        UndoRecord* next = REDO_NEWEST->older;
+        undoFreeRecord(REDO_NEWEST, false);
+        REDO_NEWEST = next;
+    }
+    UndoRecord* record = memCalloc(MemUndo, 1, sizeof(UndoRecord));
+    record->kind = kind;
+    record->node = node;
+    record->bytes = sizeof(UndoRecord);
+    if ( UNDO_BATCH >= 0 )
+        record->with_older = UNDO_BATCH++ > 0;
+    return record;
+}
+
+// the records pushed until undoEndBatch are undone and redone as one
+void undoBeginBatch(){
+    undoEndTextEdit();
+    UNDO_BATCH = 0;
+}
+
+void undoEndBatch(){
+    UNDO_BATCH = -1;
+}
+
+void undoRecordCreate(Node* node){
+    UndoRecord* record = undoPush(UndoCreate, node);
+    record->parent = node->p;
+    record->index = childIndex(node);
+    undoLinkNewest(record);
+    undoTrimToBudget();
+}
+
+void undoRecordDelete(Node* node, Node* parent, int index){
+    UndoRecord* record = undoPush(UndoDelete, node);
+    record->parent = parent;
+    record->index = index;
+    record->bytes += subtreeBytes(node);
+    undoLinkNewest(record);
+    undoTrimToBudget();
+}
+
+void undoRecordMove(Node* node, Node* old_parent, int old_index, Node* new_parent, int new_index){
+    UndoRecord* record = undoPush(UndoMove, node);
+    record->parent = old_parent;
+    record->index = old_index;
+    record->new_parent = new_parent;
+    record->new_index = new_index;
+    undoLinkNewest(record);
+    undoTrimToBudget();
+}
+
+// keystrokes are coalesced: one record per Edit session, pushed when it ends
+void undoBeginTextEdit(Node* node){
+    if ( UNDO_EDIT_NODE == node ) return;
+    undoEndTextEdit();
+    UNDO_EDIT_NODE = node;
+    UNDO_EDIT_TEXT = memStrdup(MemUndo, node->text.buf);
+}
+
+void undoEndTextEdit(){
+    if ( !UNDO_EDIT_NODE ) return;
+    if ( strcmp(UNDO_EDIT_TEXT, UNDO_EDIT_NODE->text.buf) != 0 ){
+        UndoRecord* record = undoPush(UndoText, UNDO_EDIT_NODE);
+        record->old_text = UNDO_EDIT_TEXT;
+        record->new_text = memStrdup(MemUndo, UNDO_EDIT_NODE->text.buf);
+        record->bytes += strlen(record->old_text) + strlen(record->new_text) + 2;
+        undoLinkNewest(record);
+        undoTrimToBudget();
+    }
+    else
+        memFree(MemUndo, UNDO_EDIT_TEXT);
+    UNDO_EDIT_NODE = NULL;
+    UNDO_EDIT_TEXT = NULL;
+}
+
+static void undoApply(UndoRecord* record, bool undoing){
+    switch ( record->kind ){
+        case UndoCreate: case UndoDelete:
+            // undoing a create and redoing a delete both take the node out again
+            if ( undoing == (record->kind == UndoCreate) ){
+                journalDelete(record->node);
+                detachNode(record->node);
+                searchForgetSubtree(record->node);
+            }
+            else {
+                attachNode(record->node, record->parent, record->index);
+                journalSubtree(record->node);
+                searchIndexSubtree(record->node);
+                GRAPH.selected = record->node;
+            }
+            break;
+        case UndoMove: {
+            char* from = nodePath(record->node);
+            unlinkNode(record->node);
+            if ( undoing )
+                attachNode(record->node, record->parent, record->index);
+            else
+                attachNode(record->node, record->new_parent, record->new_index);
+            journalMove(from, record->node);
+            memFree(MemOther, from);
+            GRAPH.selected = record->node;
+            break;
+        }
+        case UndoText:
+            setNodeText(record->node, undoing ? record->old_text : record->new_text);
+            journalText(record->node);
+            GRAPH.selected = record->node;
+            break;
+    }
+    unwritten = 1;
+}
+
+void undo(){
+    UndoRecord* record;
+    do {
+        record = UNDO_NEWEST;
+        if ( !record ) return;
+        UNDO_NEWEST = record->older;
+        if ( UNDO_NEWEST ) UNDO_NEWEST->newer = NULL;
+        else UNDO_OLDEST = NULL;
+        UNDO_BYTES -= record->bytes;
+        undoApply(record, true);
+        record->older = REDO_NEWEST;
+        REDO_NEWEST = record;
+    } while ( record->with_older );
+}
+
+void redo(){
+    do {
+        UndoRecord* record = REDO_NEWEST;
+        if ( !record ) break;
+        REDO_NEWEST = record->older;
+        undoApply(record, false);
+        undoLinkNewest(record);
+    } while ( REDO_NEWEST && REDO_NEWEST->with_older );
+    undoTrimToBudget();
+}
+
+
+// SELECTION
+
+/* Select mode marks several nodes, and the batch operations below change all
+ * of them as one undo step. The hints are cleared once before the batch and
+ * regenerated once after it, with a single relayout in between, rather than
+ * once per node. */
+
+void toggleMark(Node* node){
+    node->marked = !node->marked;
+    if ( node->marked ) insertArray(MARKED, node);
+    else removeFromArray(MARKED, node);
+}
+
+// called when a subtree leaves the tree, so that MARKED only holds attached nodes
+void unmarkSubtree(Node* node){
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); )
+        if ( walk.pre && cur->marked )
+            toggleMark(cur);
+    walkEnd(&walk);
+}
+
+void clearMarks(){
+    for (int i = 0; i < MARKED->num; i++)
+        MARKED->array[i]->marked = false;
+    MARKED->num = 0;
+}
+
+// empties MARKED into a new array, keeping only nodes without a marked ancestor
+// since the others go wherever their ancestor goes
+static Array* takeMarkedRoots(){
+    Array* roots = initArray(MARKED->num ? MARKED->num : 1);
+    for (int i = 0; i < MARKED->num; i++) {
+        Node* node = MARKED->array[i];
+        bool covered = false;
+        // the root is its own parent
+        for (Node* up = node; up != GRAPH.root && !covered; up = up->p)
+            covered = up->p->marked;
+        if ( !covered ) insertArray(roots, node);
+    }
+    clearMarks();
+    return roots;
+}
+
+static void beginBatch(){
+    clearHintText();
+    undoBeginBatch();
+}
+
+static void endBatch(){
+    undoEndBatch();
+    calculatePositions(GRAPH.root, GRAPH.selected);
+    unwritten = 1;
+}
+
+void deleteMarked(){
+    Array* roots = takeMarkedRoots();
+    beginBatch();
+    for (int i = 0; i < roots->num; i++)
+        if ( roots->array[i] != GRAPH.root )
+            removeNodeFromGraph(roots->array[i]);
+    endBatch();
+    freeArray(roots);
+}
+
+// reparents the marked nodes under parent, in the order they were marked
+void moveMarked(Node* parent){
+    Array* roots = takeMarkedRoots();
+    beginBatch();
+    for (int i = 0; i < roots->num; i++)
+        if ( roots->array[i] != GRAPH.root && !isInSubtree(parent, roots->array[i]) )
+            moveNode(roots->array[i], parent, -1);
+    endBatch();
+    freeArray(roots);
+}
+
+void makeChildOfMarked(){
+    Array* parents = initArray(MARKED->num ? MARKED->num : 1);
+    for (int i = 0; i < MARKED->num; i++)
+        insertArray(parents, MARKED->array[i]);
+    clearMarks();
+    beginBatch();
+    for (int i = 0; i < parents->num; i++) {
+        lazyLoadRemaining(parents->array[i]);
+        Node* child = makeChild(parents->array[i]);
+        journalCreate(child);
+        undoRecordCreate(child);
+    }
+    endBatch();
+    freeArray(parents);
+}
+
+
+// OPEN JOBS
+/*
+ * Nodes are opened by spawning xdg-open directly with an argument vector,
+ * so node text never passes through a shell. Launchers are never waited on
+ * while blocking: the main loop reaps them with WNOHANG and the status of
+ * each one stays on screen for OPEN_STATUS_MS after it exits.
+ */
+extern char** environ;
+
+typedef struct OpenJob OpenJob;
+struct OpenJob {
+    pid_t pid;
+    bool running;
+    bool failed;
+    int exit_code;          // -1 if the launcher could not run or was killed
+    Uint32 finished_at;     // 0 while the slot is free
+    char target[48];        // shortened first line of the node, for status display
+};
+
+static OpenJob OPEN_JOBS[MAX_OPEN_JOBS];
+
+// Picks a slot for a new launcher: a free one, else the longest finished one
+OpenJob* openJobSlot(){
+    OpenJob* slot = NULL;
+    for (int i = 0; i < MAX_OPEN_JOBS; i++) {
+        OpenJob* job = &OPEN_JOBS[i];
+        if ( job->running ) continue;
+        if ( !job->finished_at ) return job;
+        if ( !slot || job->finished_at < slot->finished_at ) slot = job;
+    }
+    return slot;
+}
+
+// Opens the file/url specified by the first line of the node
+void openNodeText(Node* node){
+    if ( REPLAYING ) return;
+    OpenJob* job = openJobSlot();
+    if ( !job ){
+        fprintf(stderr, "Too many opens in progress, ignoring %s\n", node->text.buf);
+        return;
+    }
+    char target[MAX_TEXT_LEN];
+    strncpy(target, node->text.buf, MAX_TEXT_LEN - 1);
+    target[MAX_TEXT_LEN - 1] = '\0';
+    endAtNewline(target, strlen(target));
+    if ( !target[0] ) return;
+    // xdg-open would read it as an option, and it does not accept "--"
+    if ( target[0] == '-' ){
+        fprintf(stderr, "Not opening %s: targets may not start with '-'\n", target);
+        return;
+    }
+
+    char* argv[] = {"xdg-open", target, NULL};
+    int err = posix_spawnp(&job->pid, "xdg-open", NULL, NULL, argv, environ);
+    strncpy(job->target, target, sizeof(job->target) - 1);
+    job->target[sizeof(job->target) - 1] = '\0';
+    job->running = !err;
+    job->failed = err;
+    job->exit_code = -1;
+    job->finished_at = err ? SDL_GetTicks() | 1 : 0;
+    if ( err ) fprintf(stderr, "Could not spawn xdg-open: %s\n", strerror(err));
+}
+
+// Collects exited launchers and expires old statuses without blocking
+void reapOpenJobs(){
+    Uint32 now = SDL_GetTicks();
+    for (int i = 0; i < MAX_OPEN_JOBS; i++) {
+        OpenJob* job = &OPEN_JOBS[i];
+        if ( job->running ){
+            int status;
+            pid_t done = waitpid(job->pid, &status, WNOHANG);
+            if ( done == 0 ) continue;
+            job->running = false;
+            job->finished_at = now | 1;
+            job->exit_code = done > 0 && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+            job->failed = job->exit_code != 0;
+        }
+        else if ( job->finished_at && now - job->finished_at > OPEN_STATUS_MS )
+            job->finished_at = 0;
+    }
+}
+
+bool openJobsShown(){
+    for (int i = 0; i < MAX_OPEN_JOBS; i++)
+        if ( OPEN_JOBS[i].running || OPEN_JOBS[i].finished_at ) return true;
+    return false;
+}
+
+// Draws one status line per shown launcher, upwards from pos
+void drawOpenJobs(Point pos){
+    for (int i = 0; i < MAX_OPEN_JOBS; i++) {
+        OpenJob* job = &OPEN_JOBS[i];
+        if ( !job->running && !job->finished_at ) continue;
+        char status[80];
+        if ( job->running )
+            snprintf(status, sizeof(status), "opening %s", job->target);
+        else if ( job->failed )
+            snprintf(status, sizeof(status), "open failed (%d): %s", job->exit_code, job->target);
+        else
+            snprintf(status, sizeof(status), "opened %s", job->target);
+        pos.y -= (int) (TEXTBOX_HEIGHT * UI_SCALE * 0.75);
+        renderMessage(status, pos, 0.75 * UI_SCALE, job->failed ? HINT_COLOR : EDIT_COLOR, 0, 0);
+    }
+}
+
+
+// EVENT HANDLING
+
+void activateHints(){
+    populateHintText(GRAPH.selected);
+    switchCurrentBuffer(&HINT_BUFFER);
+}
+
+void switchCurrentBuffer(Buffer* buffer){
+    CURRENT_BUFFER = buffer;
+    CURSOR_POSITION = buffer->len - 1;
+}
+
+void switchMode(enum Mode to){
+    if ( MODE == Edit && to != Edit ){
+        undoEndTextEdit();
+        nodeTextShare(UNSHARED_NODE);
+    }
+    if ( isHintMode(MODE) ){
+        HINT_NODES->num = 0;
+        clearBuffer(&HINT_BUFFER);
+    }
+    if ( (MODE == Search || MODE == SearchJump) && to != Search && to != SearchJump )
+        searchClearResults();
+    if ( MODE == Conflict && to != Conflict )
+        reloadKeep();
+    if ( to != Paste )
+        PASTE_AFTER = false;
+    switch ( to ){
+        case Edit: EDIT_SCROLL = 0; undoBeginTextEdit(GRAPH.selected); nodeTextUnshare(GRAPH.selected); switchCurrentBuffer(&GRAPH.selected->text); break;
+        case FilenameEdit: switchCurrentBuffer(&FILENAME_BUFFER); to = Edit; break;
+        case Search: clearBuffer(&SEARCH_BUFFER); switchCurrentBuffer(&SEARCH_BUFFER); searchUpdate(); break;
+        case Travel: TOGGLE_MODE = false; break;
+        default: break;
+    }
+    MODE = to;
+    if ( isHintMode(to) )
+        activateHints();
+}
+
+// When a hint node is selected, this function is run
+void hintFunction(Node* node){
+    logPrint("hintFunction()\n");
+    switch(MODE){
+        case Travel: case SearchJump: GRAPH.selected = node; break;
+        case Delete: removeNodeFromGraph(node); break;
+        case Cut: CUT = node; COPY = NULL; MOVE_MARKED = false; clipboardCopy(node); switchMode(Paste); break;
+        case Copy: COPY = node; CUT = NULL; MOVE_MARKED = false; clipboardCopy(node); switchMode(Paste); break;
+        case Select: toggleMark(node); break;
+        case MakeChild: {
+            lazyLoadRemaining(node);
+            Node* child = makeChild(node);
+            journalCreate(child);
+            undoRecordCreate(child);
+            activateHints();
+            break;
+        }
+        case Paste: {
+            if ( MOVE_MARKED ){
+                moveMarked(node);
+                MOVE_MARKED = false;
+                switchMode( Travel );
+                break;
+            }
+            // the target's parent and the position in it that the subtree goes to
+            Node* parent = node;
+            int index = -1;
+            if ( PASTE_AFTER ){
+                if ( node == GRAPH.root ) break;
+                parent = node->p;
+                index = childIndex(node) + 1;
+            }
+            // the copy source stays selected, so that it can be stamped out under several parents.
+            // With nothing cut or copied here, the clipboard may hold a subtree from another dtree
+            if ( COPY || !CUT ){
+                Node* copy = COPY ? copySubtree(COPY) : clipboardRead();
+                if ( !copy ) break;
+                attachNode(copy, parent, index);
+                searchIndexSubtree(copy);
+                journalSubtree(copy);
+                undoRecordCreate(copy);
+                activateHints();
+                break;
+            }
+            if ( CUT == node || isInSubtree(parent, CUT) ) break;
+            // moveNode counts the position after CUT has left its old place
+            if ( index > 0 && CUT->p == parent && childIndex(CUT) < index )
+                index--;
+            moveNode(CUT, parent, index);
+            CUT = NULL;
+            switchMode( Cut );
+            break;
+        }
+        default:
+            break;
+    }
+    if ( TOGGLE_MODE == false && MODE != Paste && MODE != Select )
+        switchMode( Travel );
+}
+
+// returns the node whose text is being edited, if any
+Node* currentBufferNode(){
+    if ( CURRENT_BUFFER && CURRENT_BUFFER == &GRAPH.selected->text )
+        return GRAPH.selected;
+    return NULL;
+}
+
+void insertCharIntoCurrentBuffer(char c){
+    if ( !CURRENT_BUFFER || CURRENT_BUFFER->len < 0 || CURRENT_BUFFER->len >= CURRENT_BUFFER->size) return;
+    for (int i = CURRENT_BUFFER->len-1; i > CURSOR_POSITION; i--) {
+        CURRENT_BUFFER->buf[i+1] = CURRENT_BUFFER->buf[i];
+    }
+    CURRENT_BUFFER->buf[++CURSOR_POSITION] = c;
+    CURRENT_BUFFER->len += 1;
+    searchMarkDirty(currentBufferNode());
+    journalText(currentBufferNode());
+    if ( currentBufferNode() ) layoutInvalidate();
+}
+void deleteCharInBufferRelativeToCursor(int relative_position){
+    if ( MODE != Search ) unwritten = 1;
+    // relative position allows us to use the same code for both backspace and delete
+    for (int i = CURSOR_POSITION + relative_position; i < CURRENT_BUFFER->len-1; i++) {
+        CURRENT_BUFFER->buf[i] = CURRENT_BUFFER->buf[i+1];
+    }
+    CURRENT_BUFFER->buf[CURRENT_BUFFER->len-1] = '\0';
+    CURSOR_POSITION -= 1 - relative_position;
+    CURRENT_BUFFER->len -= 1;
+    searchMarkDirty(currentBufferNode());
+    journalText(currentBufferNode());
+    if ( currentBufferNode() ) layoutInvalidate();
+}
+
+void handleTextInput(SDL_Event *event){
+    if ( CURRENT_BUFFER && CURRENT_BUFFER->len < CURRENT_BUFFER->size ){
+        logPrint("Adding text to current buffer...\n");
+        int add_text = 1;
+        // skip adding to buffer for hint modes if not a valid hint char
+        if ( isHintMode(MODE) ){
+            add_text = 0;
+            for (int i = 0; i < strlen(HINT_CHARS); ++i){
+                if ( HINT_CHARS[i] == event->edit.text[0] ){
+                    add_text = 1;
+                    break;
+                }
+            }
+        }
+        else if ( MODE != Search )
+            unwritten = 1;
+
+        // Add text to buffer
+        if ( add_text ) insertCharIntoCurrentBuffer(event->edit.text[0]);
+        if ( MODE == Search ) searchUpdate();
+        logPrint("Detected character: %c\n", event->edit.text[0]);
+        logPrint("New CURRENT_BUFFER: len %d: %s\n", CURRENT_BUFFER->len, CURRENT_BUFFER->buf);
+    }
+    if ( isHintMode(MODE) ){
+        // go to node specified by travel chars
+        logPrint("Handling travel input: %d/%d chars\n", HINT_BUFFER.len, HINT_BUFFER.size);
+        // check if any nodes hint text matches current input
+        for (int i = 0; i < HINT_NODES->num; ++i) {
+            // continue if hint buffer != any hint text
+            if ( strcmp(HINT_BUFFER.buf, HINT_NODES->array[i]->hint_text) != 0 )
+                continue;
+            hintFunction(HINT_NODES->array[i]);
+            // reset hint text
+
+            logPrint("Freeing hint buffer\n");
+            clearBuffer(&HINT_BUFFER);
+            logPrint("Freed hint buffer\n");
+
+            logPrint("Re-calculating positions of nodes...\n");
+            calculatePositions(GRAPH.root, GRAPH.selected);
+            logPrint("Populating hint text...\n");
+            populateHintText(GRAPH.selected);
+            logPrint("Populated.\n");
+        }
+        logPrint("Handled hint input.\n");
+    }
+}
+
+// can only handle +1 and -1
+void moveCursorLine(int relative_line){
+    char** lines = getLines(GRAPH.selected->text.buf, true);
+    int len_so_far = 0;
+
+    for (int i = 0; lines[i]; i++) {
+            if ( CURSOR_POSITION < len_so_far - 1 || CURSOR_POSITION > len_so_far + (int) strlen(lines[i]) - 1 ) {
+                len_so_far += (int) strlen(lines[i]) + 1;
+                continue;
+            }
+            if ( relative_line == 1 && !lines[i+1] ) CURSOR_POSITION = CURRENT_BUFFER->len - 1;
+            if ( relative_line == -1 && i == 0 ) CURSOR_POSITION = -1;
+
+            int col = CURSOR_POSITION - len_so_far;
+            // Move Up
+            if ( relative_line == -1 && i > 0 ){
+                if ( col > (int) strlen(lines[i-1]) )
+                    CURSOR_POSITION -= col + 1 + 1;
+                else
+                    CURSOR_POSITION -= strlen(lines[i-1]) + 1;
+            }
+            // Move Down
+            else if ( relative_line == 1 && lines[i+1] ){
+                if ( col > (int) strlen(lines[i+1]) - 1 )
+                    CURSOR_POSITION += strlen(lines[i]) - col + strlen(lines[i+1]);
+                else
+                    CURSOR_POSITION += strlen(lines[i]) + 1;
+            }
+            break;
+    }
+    freeLines(lines);
+}
+
+/* Commands fire when their key goes down, looked up in KEYMAP. The first binding for the
+ * current mode and key whose modifier is held wins, so bindings that need a modifier come
+ * before the plain one. Held keys repeat only the bindings marked so. SDL follows the key-down
+ * of a printable key with its TEXTINPUT, which would land in the buffer of the mode the
+ * command switched to, so the text of a key that ran a command is dropped, repeats included. */
+typedef struct KeyBinding KeyBinding;
+struct KeyBinding {
+    unsigned int modes;     // MODE_BIT of each mode the binding applies in
+    SDL_Keycode key;
+    Uint16 mod;             // modifiers one of which must be held, 0 for none in particular
+    bool repeat;            // also fires on the repeats of a held key
+    void (*action)();       // if NULL, the binding switches to mode to
+    enum Mode to;
+};
+
+#define MODE_BIT(mode) (1u << (mode))
+#define ALL_MODES (~0u)
+#define EDIT_MODES (MODE_BIT(Edit) | MODE_BIT(FilenameEdit) | MODE_BIT(Search))
+
+static SDL_Keycode HELD_KEY = SDLK_UNKNOWN;   // key down that last ran a command
+static bool DROP_TEXT_INPUT = false;          // the next TEXTINPUT comes from a command key
+
+static void keyEscape(){
+    // clear cut, copied and marked nodes on a double escape
+    if (MODE == Travel){
+        CUT = COPY = NULL;
+        MOVE_MARKED = false;
+        clearMarks();
+    }
+    switchMode(Travel);
+}
+static void keyMemoryOverlay(){ MEMORY_OVERLAY = !MEMORY_OVERLAY; }
+static void keyBackspace(){ deleteCharInBufferRelativeToCursor(0); if ( MODE == Search ) searchUpdate(); }
+static void keyDelete(){ deleteCharInBufferRelativeToCursor(1); if ( MODE == Search ) searchUpdate(); }
+static void keyCursorLeft(){ CURSOR_POSITION = max(CURSOR_POSITION-1,-1); }
+static void keyCursorRight(){ CURSOR_POSITION = min(CURSOR_POSITION+1,CURRENT_BUFFER->len-1); }
+static void keyCursorUp(){ moveCursorLine(-1); }
+static void keyCursorDown(){ moveCursorLine(1); }
+static void keyNewline(){ insertCharIntoCurrentBuffer('\n'); }
+static void keyZoomOut(){ GRAPH_SCALE *= 1/ZOOM_SPEED; layoutInvalidate(); }
+static void keyZoomIn(){ GRAPH_SCALE *= ZOOM_SPEED; layoutInvalidate(); }
+static void keyQuit(){ APP.quit = true; }
+static void keyToggleMinimap(){ MINIMAP_SHOWN = !MINIMAP_SHOWN; }
+static void keyToggleMode(){ TOGGLE_MODE = true; }
+static void keySubstitute(){
+    undoBeginTextEdit(GRAPH.selected);
+    setNodeText(GRAPH.selected, "");
+    journalText(GRAPH.selected);
+    switchMode(Edit);
+}
+static void keyUndo(){
+    undo();
+    calculatePositions(GRAPH.root, GRAPH.selected);
+    populateHintText(GRAPH.selected);
+}
+static void keyRedo(){
+    redo();
+    calculatePositions(GRAPH.root, GRAPH.selected);
+    populateHintText(GRAPH.selected);
+}
+static void keyOpenNodeText(){ openNodeText(GRAPH.selected); }
+static void keyExportPng(){ exportCurrentTree(".png"); }
+static void keyExportSvg(){ exportCurrentTree(".svg"); }
+static void keySearchJump(){ if ( SEARCH_RESULTS->num > 0 ) switchMode(SearchJump); }
+static void keyDeleteMarked(){ deleteMarked(); switchMode(Travel); }
+static void keyChildOfMarked(){ makeChildOfMarked(); switchMode(Travel); }
+static void keyMoveMarked(){
+    if ( !MARKED->num ) return;
+    CUT = COPY = NULL;
+    MOVE_MARKED = true;
+    switchMode(Paste);
+}
+static void keyReload(){ reloadApply(); switchMode(Travel); }
+static void keyPasteAfter(){ if ( !MOVE_MARKED ) PASTE_AFTER = !PASTE_AFTER; }
+
+static const KeyBinding KEYMAP[] = {
+    {ALL_MODES,             SDLK_ESCAPE,    0,          false, keyEscape},
+    {ALL_MODES,             SDLK_F2,        0,          false, keyMemoryOverlay},
+    {EDIT_MODES,            SDLK_BACKSPACE, 0,          true,  keyBackspace},
+    {EDIT_MODES,            SDLK_DELETE,    0,          true,  keyDelete},
+    {EDIT_MODES,            SDLK_LEFT,      0,          true,  keyCursorLeft},
+    {EDIT_MODES,            SDLK_RIGHT,     0,          true,  keyCursorRight},
+    {EDIT_MODES,            SDLK_UP,        0,          true,  keyCursorUp},
+    {EDIT_MODES,            SDLK_DOWN,      0,          true,  keyCursorDown},
+    {~EDIT_MODES,           SDLK_MINUS,     0,          true,  keyZoomOut},
+    {~EDIT_MODES,           SDLK_EQUALS,    0,          true,  keyZoomIn},
+    {~EDIT_MODES,           SDLK_q,         0,          false, keyQuit},
+    {MODE_BIT(Travel),      SDLK_o,         0,          false, NULL, MakeChild},
+    {MODE_BIT(Travel),      SDLK_e,         0,          false, NULL, Edit},
+    {MODE_BIT(Travel),      SDLK_r,         0,          false, NULL, FilenameEdit},
+    {MODE_BIT(Travel),      SDLK_x,         0,          false, NULL, Delete},
+    {MODE_BIT(Travel),      SDLK_m,         0,          false, NULL, Cut},
+    {MODE_BIT(Travel),      SDLK_y,         0,          false, NULL, Copy},
+    {MODE_BIT(Travel),      SDLK_v,         0,          false, NULL, Select},
+    {MODE_BIT(Travel),      SDLK_n,         0,          false, keyToggleMinimap},
+    {MODE_BIT(Travel),      SDLK_p,         0,          false, NULL, Paste},
+    {MODE_BIT(Travel),      SDLK_s,         0,          false, keySubstitute},
+    {MODE_BIT(Travel),      SDLK_u,         KMOD_SHIFT, true,  keyRedo},
+    {MODE_BIT(Travel),      SDLK_u,         0,          true,  keyUndo},
+    {MODE_BIT(Travel),      SDLK_c,         0,          false, keyToggleMode},
+    {MODE_BIT(Travel),      SDLK_w,         0,          false, writeFile},
+    {MODE_BIT(Travel),      SDLK_t,         0,          false, keyOpenNodeText},
+    {MODE_BIT(Travel),      SDLK_i,         KMOD_SHIFT, false, keyExportSvg},
+    {MODE_BIT(Travel),      SDLK_i,         0,          false, keyExportPng},
+    {MODE_BIT(Travel),      SDLK_SLASH,     0,          false, NULL, Search},
+    {MODE_BIT(Search),      SDLK_RETURN,    0,          false, keySearchJump},
+    {MODE_BIT(Edit),        SDLK_RETURN,    0,          true,  keyNewline},
+    {MODE_BIT(Delete),      SDLK_x,         0,          false, NULL, Travel},
+    {MODE_BIT(Select),      SDLK_v,         0,          false, NULL, Travel},
+    {MODE_BIT(Select),      SDLK_x,         0,          false, keyDeleteMarked},
+    {MODE_BIT(Select),      SDLK_o,         0,          false, keyChildOfMarked},
+    {MODE_BIT(Select),      SDLK_m,         0,          false, keyMoveMarked},
+    {MODE_BIT(Paste),       SDLK_TAB,       0,          false, keyPasteAfter},
+    {MODE_BIT(Conflict),    SDLK_r,         0,          false, keyReload},
+    {MODE_BIT(Conflict),    SDLK_k,         0,          false, NULL, Travel},
+};
+
+static const KeyBinding* findKeyBinding(SDL_Keycode key, Uint16 mod){
+    for (size_t i = 0; i < sizeof(KEYMAP) / sizeof(KEYMAP[0]); i++) {
+        const KeyBinding* binding = &KEYMAP[i];
+        if ( binding->key == key && (binding->modes & MODE_BIT(MODE)) && (!binding->mod || (mod & binding->mod)) )
+            return binding;
+    }
+    return NULL;
+}
+
+void doKeyDown(SDL_KeyboardEvent *event) {
+    SDL_Keycode key = event->keysym.sym;
+    DROP_TEXT_INPUT = event->repeat && key == HELD_KEY;
+    const KeyBinding* binding = findKeyBinding(key, event->keysym.mod);
+    if ( !binding || (event->repeat && !binding->repeat) ) return;
+    HELD_KEY = key;
+    DROP_TEXT_INPUT = true;
+    if ( binding->action ) binding->action();
+    else switchMode(binding->to);
+}
+
+void doKeyUp(SDL_KeyboardEvent *event) {
+    if ( event->keysym.sym == HELD_KEY )
+        HELD_KEY = SDLK_UNKNOWN;
+}
+
+void eventHandler(SDL_Event *event) {
+    switch (event->type){
+        case SDL_TEXTINPUT:
+            if ( DROP_TEXT_INPUT ) DROP_TEXT_INPUT = false;
+            else handleTextInput(event);
+            break;
+        case SDL_KEYDOWN: doKeyDown(&event->key); break;
+        case SDL_KEYUP: doKeyUp(&event->key); break;
+        case SDL_QUIT: exit(0); break;
+        case SDL_MOUSEBUTTONDOWN:
+            // jumping only moves the view, the minimap texture stays as it is
+            if ( MODE == Travel && minimapClick(event->button.x, event->button.y) ){
+                calculatePositions(GRAPH.root, GRAPH.selected);
+                populateHintText(GRAPH.selected);
+            }
+            break;
+        case SDL_RENDER_TARGETS_RESET: minimapInvalidate(); break;
+        case SDL_WINDOWEVENT:
+            if(event->window.event == SDL_WINDOWEVENT_RESIZED)
+                SDL_GetWindowSize(APP.window, &APP.window_size.x, &APP.window_size.y);
+            break;
+        default:
+            if ( event->type == RELOAD_EVENT )
+                reloadReceive(event->user.data1);
+            else if ( layoutReceive(event) ){
+                calculatePositions(GRAPH.root, GRAPH.selected);
+                if ( isHintMode(MODE) )
+                    populateHintText(GRAPH.selected);
+            }
+            break;
+    }
+}
+
+
+// POSITION CALCULATION ALGORITHM
+
+// shifts a node's children over so that their subtrees do not overlap at any x-coordinate,
+// and centers the node above them. The children must have been offset already.
+void offsetNode(Node* node) {
+
+    logPrint("Calculating offsets for %p...\n", node);
+    int text_pixel_length = getWidth(node->text.buf, true) * GRAPH_SCALE;
+    node -> x_offset  = 0;
+    node -> rightmost = text_pixel_length/2;
+    node -> leftmost  = -text_pixel_length/2;
+    int total_offset = 0;
+    logPrint("Shifting %ld children for node with text %s\n", node->children->num, node->text.buf);
+    for (int i = 1; i < node->children->num; i++) {
+        Node* child = node->children->array[i];
+        // shift the current child (more than) far enough away from the
+        // previous to guarantee that they subtrees will not overlap
+        int offset = (node->children->array[i-1]->rightmost)-(child->leftmost)+RADIUS;
+        total_offset += offset;
+        child->x_offset = total_offset;
+    }
+    logPrint("Centering parent\n");
+    // center parent over children
+    for (int i = 0; i < node->children->num; i++) {
+        Node* child = node->children->array[i];
+        child->x_offset -= total_offset/2;
+    }
+    // calculate leftmost and rightmost for current node
+    logPrint("Calculating left and rightmost children\n");
+    if(node->children->num >= 1) {
         Node* leftmost_child = node->children->array[0];
         int child_leftmost = leftmost_child->x_offset + leftmost_child->leftmost;
         if(child_leftmost < node->leftmost) {
             node->leftmost = child_leftmost;
         }
 
-        Node* rightmost_child = node->children->array[node->children->num-1];
-        int child_rightmost = rightmost_child->x_offset + rightmost_child->rightmost;
-        if(child_rightmost > node->rightmost) {
-            node->rightmost = child_rightmost;
+        Node* rightmost_child = node->children->array[node->children->num-1];
+        int child_rightmost = rightmost_child->x_offset + rightmost_child->rightmost;
+        if(child_rightmost > node->rightmost) {
+            node->rightmost = child_rightmost;
+        }
+    }
+}
+
+// first pass of calculatePositions. In one walk it offsets each node on the way up, and
+// on the way down records the height of the tallest node of each level. Returns the level
+// heights, *depth is set to the number of levels, which the root's aggregates already know.
+int* calculateOffsets(Node* root, int* depth) {
+    *depth = root->height + 1;
+    int* y_levels = memCalloc(MemOther, *depth + 1, sizeof(int));
+    Walk walk;
+    walkBegin(&walk, root);
+    for (Node* node; (node = walkNext(&walk)); ) {
+        if ( !walk.pre ){
+            offsetNode(node);
+            continue;
+        }
+        int node_height = nodeTextHeight(node->text.buf) * GRAPH_SCALE +RADIUS;
+        if (node_height > y_levels[walk.level]) {
+            y_levels[walk.level] = node_height;
+        }
+    }
+    walkEnd(&walk);
+    return y_levels;
+}
+
+// second pass of calculatePositions, accumulates offsets to assign correct [x,y] values
+// to each node. The tree is placed so that the selected node is at the center of the
+// screen, which only needs the offsets on the path from the selected node up to the root.
+void applyOffsets(Node* root, Node* selected, int* y_levels) {
+    int selected_x = 0, level = 0;
+    for (Node* node = selected; node != root && node != GRAPH.root; node = node->p) {
+        selected_x += node->x_offset;
+        level++;
+    }
+    int selected_y = 0;
+    for (; level > 0; level--)
+        selected_y += y_levels[level-1]/2 + y_levels[level]/2;
+
+    root->pos.x = APP.window_size.x/2 - selected_x;
+    root->pos.y = APP.window_size.y/2 - selected_y;
+    Walk walk;
+    walkBegin(&walk, root);
+    for (Node* node; (node = walkNext(&walk)); ) {
+        if ( !walk.pre || node == root ) continue;
+        node->pos.x = node->p->pos.x + node->x_offset;
+        node->pos.y = node->p->pos.y + y_levels[walk.level-1]/2 + y_levels[walk.level]/2;
+    }
+    walkEnd(&walk);
+}
+
+/* The offsets and level heights only depend on the text and shape of the tree and on the
+ * layout parameters, so they are kept until one of those changes. Moving the selection or
+ * resizing the window only needs the second pass. */
+static bool LAYOUT_DIRTY = true;        // offsets and LAYOUT_LEVELS are out of date
+static int* LAYOUT_LEVELS = NULL;       // height of the tallest node of each level
+static int LAYOUT_DEPTH = 0;
+static unsigned int LAYOUT_VERSION = 0; // bumped with every change to the tree
+
+// called whenever the text or the shape of the tree changes
+void layoutInvalidate(){
+    LAYOUT_DIRTY = true;
+    LAYOUT_VERSION++;
+}
+
+/* Once the event loop runs, the first pass over a tree of LAYOUT_ASYNC_MIN_NODES nodes or more
+ * is done by a worker thread, so that input is not held up while a big tree is laid out again.
+ * The tree and SDL stay on the main thread: it copies what the first pass reads into a LayoutJob,
+ * in pre-order, and retains the shared texts so that edits cannot free them under the worker.
+ * The worker writes the offsets and level heights into the job and pushes LAYOUT_EVENT. Until
+ * then the main thread goes on drawing the last complete layout, with nodes added since placed
+ * under their parents. A finished job is copied onto the nodes in one go if LAYOUT_VERSION
+ * still matches, otherwise it is dropped and layoutReceive starts another on the current tree. */
+typedef struct LayoutJobNode LayoutJobNode;
+struct LayoutJobNode {
+    Node* node;             // only dereferenced on the main thread
+    char* text;             // retained shared text, NULL when width and height are already set
+    size_t size;            // the next sibling is size entries further on
+    int level;
+    int width;
+    int height;
+    int x_offset;
+    int leftmost;
+    int rightmost;
+};
+
+typedef struct LayoutJob LayoutJob;
+struct LayoutJob {
+    unsigned int version;   // LAYOUT_VERSION when the job was taken
+    double scale;           // GRAPH_SCALE when the job was taken
+    size_t num;
+    LayoutJobNode* nodes;
+    int* levels;            // like the result of calculateOffsets
+    int depth;
+};
+
+static bool LAYOUT_ASYNC = false;
+static Uint32 LAYOUT_EVENT = (Uint32) -1;
+static SDL_Thread* LAYOUT_THREAD = NULL;
+static LayoutJob* LAYOUT_JOB = NULL;    // the job LAYOUT_THREAD works on
+
+static LayoutJob* layoutJobTake(Node* root){
+    LayoutJob* job = memCalloc(MemOther, 1, sizeof(LayoutJob));
+    job->version = LAYOUT_VERSION;
+    job->scale = GRAPH_SCALE;
+    job->num = root->size;
+    job->nodes = memMalloc(MemOther, job->num * sizeof(LayoutJobNode));
+    job->depth = root->height + 1;
+    job->levels = memCalloc(MemOther, job->depth + 1, sizeof(int));
+    size_t i = 0;
+    Walk walk;
+    walkBegin(&walk, root);
+    for (Node* node; (node = walkNext(&walk)); ) {
+        if ( !walk.pre ) continue;
+        LayoutJobNode* entry = &job->nodes[i++];
+        entry->node = node;
+        entry->size = node->size;
+        entry->level = walk.level;
+        // text in the node or being edited is not the worker's to read, it is measured here
+        entry->text = node->text.size || nodeTextInline(node) ? NULL : internRetain(node->text.buf);
+        if ( !entry->text ){
+            entry->width = getWidth(node->text.buf, true) * job->scale;
+            entry->height = nodeTextHeight(node->text.buf) * job->scale +RADIUS;
+        }
+    }
+    walkEnd(&walk);
+    return job;
+}
+
+// the first pass over a job, the same as calculateOffsets and offsetNode do over the tree.
+// Children come after their parent in pre-order, so going backwards offsets them first.
+static void layoutJobRun(LayoutJob* job){
+    LayoutJobNode* nodes = job->nodes;
+    for (size_t i = job->num; i-- > 0; ) {
+        LayoutJobNode* node = &nodes[i];
+        if ( node->text ){
+            node->width = getWidth(node->text, true) * job->scale;
+            node->height = nodeTextHeight(node->text) * job->scale +RADIUS;
+        }
+        if ( node->height > job->levels[node->level] )
+            job->levels[node->level] = node->height;
+        node->x_offset  = 0;
+        node->rightmost = node->width/2;
+        node->leftmost  = -node->width/2;
+        if ( node->size == 1 ) continue;
+        int total_offset = 0;
+        size_t first = i + 1, last = first;
+        for (size_t child = first + nodes[first].size; child < i + node->size; child += nodes[child].size) {
+            int offset = nodes[last].rightmost - nodes[child].leftmost + RADIUS;
+            total_offset += offset;
+            nodes[child].x_offset = total_offset;
+            last = child;
+        }
+        for (size_t child = first; child < i + node->size; child += nodes[child].size)
+            nodes[child].x_offset -= total_offset/2;
+        node->leftmost = min(node->leftmost, nodes[first].x_offset + nodes[first].leftmost);
+        node->rightmost = max(node->rightmost, nodes[last].x_offset + nodes[last].rightmost);
+    }
+}
+
+static int layoutThread(void* data){
+    layoutJobRun(data);
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = LAYOUT_EVENT;
+    SDL_PushEvent(&event);
+    return 0;
+}
+
+// copies a finished job onto the tree if nothing changed since it was taken, then frees it
+static bool layoutJobFinish(LayoutJob* job){
+    bool current = job->version == LAYOUT_VERSION;
+    if ( current ){
+        for (size_t i = 0; i < job->num; i++) {
+            Node* node = job->nodes[i].node;
+            node->x_offset = job->nodes[i].x_offset;
+            node->leftmost = job->nodes[i].leftmost;
+            node->rightmost = job->nodes[i].rightmost;
+        }
+        if ( LAYOUT_LEVELS ) memFree(MemOther, LAYOUT_LEVELS);
+        LAYOUT_LEVELS = job->levels;
+        LAYOUT_DEPTH = job->depth;
+        LAYOUT_DIRTY = false;
+    }
+    else
+        memFree(MemOther, job->levels);
+    for (size_t i = 0; i < job->num; i++)
+        if ( job->nodes[i].text ) internRelease(job->nodes[i].text);
+    memFree(MemOther, job->nodes);
+    memFree(MemOther, job);
+    return current;
+}
+
+// collects the job LAYOUT_THREAD works on, waiting for it if it is not done yet
+static bool layoutWait(){
+    if ( !LAYOUT_JOB ) return false;
+    if ( LAYOUT_THREAD ) SDL_WaitThread(LAYOUT_THREAD, NULL);
+    LAYOUT_THREAD = NULL;
+    LayoutJob* job = LAYOUT_JOB;
+    LAYOUT_JOB = NULL;
+    return layoutJobFinish(job);
+}
+
+// hands the first pass to the worker unless it is busy. The previous level heights are
+// stretched to the current depth, so that the second pass can place nodes added since.
+static void layoutStart(Node* root){
+    if ( LAYOUT_DEPTH < root->height + 1 ){
+        int depth = root->height + 1;
+        LAYOUT_LEVELS = memRealloc(MemOther, LAYOUT_LEVELS, (depth + 1) * sizeof(int));
+        for (int level = LAYOUT_DEPTH; level <= depth; level++)
+            LAYOUT_LEVELS[level] = LAYOUT_LEVELS[LAYOUT_DEPTH - 1];
+        LAYOUT_DEPTH = depth;
+    }
+    if ( LAYOUT_JOB ) return;
+    logPrint("Starting layout of %zu nodes\n", root->size);
+    LAYOUT_JOB = layoutJobTake(root);
+    LAYOUT_THREAD = SDL_CreateThread(layoutThread, "layout", LAYOUT_JOB);
+    if ( !LAYOUT_THREAD ){
+        layoutJobRun(LAYOUT_JOB);
+        layoutWait();
+    }
+}
+
+// lets calculatePositions hand large layouts to the worker, once the event loop can receive them
+void layoutAsyncBegin(){
+    LAYOUT_EVENT = SDL_RegisterEvents(1);
+    LAYOUT_ASYNC = LAYOUT_EVENT != (Uint32) -1;
+}
+
+// takes in a finished job and starts the next one if the tree changed while it ran,
+// true if the offsets are up to date afterwards
+bool layoutReceive(SDL_Event* event){
+    if ( event->type != LAYOUT_EVENT ) return false;
+    layoutWait();
+    if ( LAYOUT_DIRTY )
+        layoutStart(GRAPH.root);
+    return !LAYOUT_DIRTY;
+}
+
+// brings the offsets up to date before returning, for when the final layout is needed
+void layoutSync(Node* root){
+    layoutWait();
+    if ( !LAYOUT_DIRTY ) return;
+    logPrint("Calculating offsets and y levels...\n");
+    if ( LAYOUT_LEVELS ) memFree(MemOther, LAYOUT_LEVELS);
+    LAYOUT_LEVELS = calculateOffsets(root, &LAYOUT_DEPTH);
+    logPrint("%d levels\n", LAYOUT_DEPTH);
+    LAYOUT_DIRTY = false;
+}
+
+// recomputes the coordinates of the nodes (i.e. populates pos field) in two walks over the tree
+void calculatePositions(Node* root, Node* selected){
+    logPrint("calculatingPositions...\n");
+    lazyFollowSelection();
+
+    if ( LAYOUT_DIRTY && LAYOUT_ASYNC && LAYOUT_LEVELS && root->size >= LAYOUT_ASYNC_MIN_NODES )
+        layoutStart(root);
+    else
+        layoutSync(root);
+    logPrint("Applying offsets...\n");
+    applyOffsets(root, GRAPH.selected, LAYOUT_LEVELS);
+    logPrint("Positions calculated.\n");
+}
+
+/* The layout of a large file is saved next to it in "<file>.layout", so that opening it again
+ * unchanged can skip the first pass. The cache holds the offsets of every node in pre-order and
+ * the level heights. It is keyed by FILE_HASH, which readFile computes anyway, and by a hash
+ * of the layout parameters, so it only applies to a tree exactly as it was read. */
+typedef struct LayoutCacheHeader LayoutCacheHeader;
+struct LayoutCacheHeader {
+    char magic[16];
+    unsigned long long file_hash;
+    unsigned long long params_hash;
+    unsigned long long nodes;
+    unsigned long long levels;
+};
+
+typedef struct LayoutCacheNode LayoutCacheNode;
+struct LayoutCacheNode {
+    int x_offset;
+    int leftmost;
+    int rightmost;
+};
+
+static const char LAYOUT_CACHE_MAGIC[16] = "dtree-layout 1\n";
+
+static void layoutCachePath(char* path, size_t size){
+    snprintf(path, size, "%s.layout", FILENAME_BUFFER.buf);
+}
+
+static unsigned long long layoutParamsHash(){
+    int ints[5] = {TEXTBOX_WIDTH_SCALE, TEXTBOX_HEIGHT, NUM_CHARS_B4_WRAP, RADIUS, MAX_NODE_LINES};
+    unsigned long long hash = fnv1a(FNV_OFFSET, (char*) ints, sizeof(ints));
+    return fnv1a(hash, (char*) &GRAPH_SCALE, sizeof(GRAPH_SCALE));
+}
+
+// Loads the offsets from the layout cache, returns whether it matched the file just read
+bool layoutCacheLoad(){
+    char path[FILENAME_MAX];
+    layoutCachePath(path, sizeof(path));
+    FILE* fp = fopen(path, "rb");
+    if ( !fp ) return false;
+    LayoutCacheHeader header;
+    bool loaded = false;
+    if ( fread(&header, sizeof(header), 1, fp) == 1 && memcmp(header.magic, LAYOUT_CACHE_MAGIC, sizeof(header.magic)) == 0
+         && header.file_hash == FILE_HASH && header.params_hash == layoutParamsHash()
+         && header.nodes == subtreeSize(GRAPH.root)
+         && header.levels == (unsigned long long) GRAPH.root->height + 1 ){
+        LayoutCacheNode* offsets = memMalloc(MemFiles, header.nodes * sizeof(LayoutCacheNode));
+        int* levels = memMalloc(MemOther, header.levels * sizeof(int));
+        loaded = fread(levels, sizeof(int), header.levels, fp) == header.levels
+                 && fread(offsets, sizeof(LayoutCacheNode), header.nodes, fp) == header.nodes;
+        if ( loaded ){
+            size_t num = 0;
+            Walk walk;
+            walkBegin(&walk, GRAPH.root);
+            for (Node* node; (node = walkNext(&walk)); ) {
+                if ( !walk.pre ) continue;
+                node->x_offset = offsets[num].x_offset;
+                node->leftmost = offsets[num].leftmost;
+                node->rightmost = offsets[num].rightmost;
+                num++;
+            }
+            walkEnd(&walk);
+            if ( LAYOUT_LEVELS ) memFree(MemOther, LAYOUT_LEVELS);
+            LAYOUT_LEVELS = levels;
+            LAYOUT_DEPTH = header.levels;
+            LAYOUT_DIRTY = false;
+        }
+        else
+            memFree(MemOther, levels);
+        memFree(MemFiles, offsets);
+    }
+    fclose(fp);
+    logPrint("Layout cache %s\n", loaded ? "loaded" : "missed");
+    return loaded;
+}
+
+// Writes the layout of the file just read to the layout cache
+void layoutCacheSave(){
+    size_t nodes = subtreeSize(GRAPH.root);
+    if ( REPLAYING || LAYOUT_DIRTY || nodes < LAYOUT_CACHE_MIN_NODES ) return;
+    char path[FILENAME_MAX];
+    layoutCachePath(path, sizeof(path));
+    FILE* fp = fopen(path, "wb");
+    if ( !fp ){
+        fprintf(stderr, "Could not write layout cache %s: %s\n", path, strerror(errno));
+        return;
+    }
+    LayoutCacheHeader header = {{0}, FILE_HASH, layoutParamsHash(), nodes, LAYOUT_DEPTH};
+    memcpy(header.magic, LAYOUT_CACHE_MAGIC, sizeof(header.magic));
+    fwrite(&header, sizeof(header), 1, fp);
+    fwrite(LAYOUT_LEVELS, sizeof(int), LAYOUT_DEPTH, fp);
+    Walk walk;
+    walkBegin(&walk, GRAPH.root);
+    for (Node* node; (node = walkNext(&walk)); ) {
+        if ( !walk.pre ) continue;
+        LayoutCacheNode offsets = {node->x_offset, node->leftmost, node->rightmost};
+        fwrite(&offsets, sizeof(offsets), 1, fp);
+    }
+    walkEnd(&walk);
+    if ( fclose(fp) != 0 ){
+        fprintf(stderr, "Could not write layout cache %s: %s\n", path, strerror(errno));
+        remove(path);
+    }
+}
+
+void layoutClose(){
+    layoutWait();
+    if ( LAYOUT_LEVELS ) memFree(MemOther, LAYOUT_LEVELS);
+    LAYOUT_LEVELS = NULL;
+}
+
+/* Debug function, used to print locations of all nodes in indented hierarchy */
+// dead code
+void recursivelyPrintPositions(Node* node, int level){
+    for (int i=0; i<level; i++){
+        logPrint("\t");
+    }
+    logPrint("%d %d\n",node->pos.x, node->pos.y);
+
+    for (int i = 0; i < node->children->num; i++) {
+        recursivelyPrintPositions(node->children->array[i], level + 1);
+    }
+}
+
+
+// RENDERING
+void renderMessage(char* message, Point pos, double scale, SDL_Color color, bool wrap, bool cursor){
+    renderLines(message, pos, scale, color, wrap, cursor, 0, INT_MAX);
+}
+
+/* Renders count lines of a message starting at line first, the first of them at pos. Lines
+ * outside the render target are skipped before they are rasterized, so a message costs
+ * time for the lines that are actually visible. */
+void renderLines(char* message, Point pos, double scale, SDL_Color color, bool wrap, bool cursor, int first, int count){
+    if (!message) return;
+
+    char* line = memMalloc(MemLines, strlen(message) + 1);
+    char* tok = message;
+    int len_so_far = 0;
+    for (int cur_line = 0; cur_line - first < count; cur_line++) {
+        char* line_end = getEndOfLine(tok, wrap);
+        if ( !line_end ) break;
+        int line_len = line_end - tok;
+        if ( line_len > 0 && tok[line_len - 1] == '\n' ) line_len--;
+
+        SDL_Rect message_rect;
+        message_rect.x = pos.x;
+        message_rect.y = pos.y + (TEXTBOX_HEIGHT * (cur_line - first) * GRAPH_SCALE);
+        message_rect.w = line_len * TEXTBOX_WIDTH_SCALE * scale;
+        message_rect.h = TEXTBOX_HEIGHT * scale;
+        if ( cur_line >= first && message_rect.y + message_rect.h >= 0 && message_rect.y < APP.window_size.y ){
+            memcpy(line, tok, line_len);
+            line[line_len] = '\0';
+
+            // create surface from string
+            SDL_Surface* surface_message;
+            surface_message = TTF_RenderText_Solid(FONT, line, color);
+
+            // now you can convert it into a texture
+            SDL_Texture* texture_message = SDL_CreateTextureFromSurface(APP.renderer, surface_message);
+
+            SDL_SetRenderDrawColor(APP.renderer, BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b, 255);
+            SDL_RenderFillRect(APP.renderer, &message_rect);
+            logPrint("Rendering %s %d %d\n", message, message_rect.w, message_rect.h);
+            SDL_RenderCopy(APP.renderer, texture_message, NULL, &message_rect);
+
+            // draw cursor (the int cast is required)
+            if (cursor && len_so_far <= CURSOR_POSITION + 1 && CURSOR_POSITION < len_so_far + line_len ){
+                int cursor_offset = (CURSOR_POSITION + 1 - len_so_far) * TEXTBOX_WIDTH_SCALE * GRAPH_SCALE;
+                SDL_SetRenderDrawColor(APP.renderer, EDIT_COLOR.r, EDIT_COLOR.g, EDIT_COLOR.b, 255);
+                SDL_RenderDrawLine(APP.renderer, message_rect.x + cursor_offset, message_rect.y, message_rect.x + cursor_offset, message_rect.y + (TEXTBOX_HEIGHT * GRAPH_SCALE));
+            }
+
+            SDL_FreeSurface(surface_message);
+            SDL_DestroyTexture(texture_message);
+        }
+        len_so_far += line_len + 1;
+        tok = line_end;
+        if ( *line_end == ' ' ) tok = line_end+1;
+    }
+    memFree(MemLines, line);
+}
+
+// first line to show of the text being edited, moved just enough to keep the cursor in view
+static int editScroll(char* text){
+    int cursor_line = 0, len_so_far = 0, lines = 0;
+    for (char* tok = text, *line_end; (line_end = getEndOfLine(tok, true)); lines++) {
+        int line_len = line_end - tok - (line_end[-1] == '\n');
+        if ( len_so_far <= CURSOR_POSITION + 1 && CURSOR_POSITION < len_so_far + line_len )
+            cursor_line = lines;
+        len_so_far += line_len + 1;
+        tok = *line_end == ' ' ? line_end + 1 : line_end;
+    }
+    if ( CURSOR_POSITION + 1 >= len_so_far ) cursor_line = max(0, lines - 1);
+    EDIT_SCROLL = min(EDIT_SCROLL, cursor_line);
+    EDIT_SCROLL = max(EDIT_SCROLL, cursor_line - MAX_NODE_LINES + 1);
+    EDIT_SCROLL = max(0, min(EDIT_SCROLL, lines - MAX_NODE_LINES));
+    return EDIT_SCROLL;
+}
+
+void drawBox(SDL_Renderer *surface, int n_cx, int n_cy, int len, int height, int offset, const SDL_Color color){
+    SDL_Rect rect;
+    rect.x = (int) n_cx - ( len  / 2 )  - offset;
+    rect.y = (int) n_cy - ( height / 2 ) - offset;
+    rect.w = len + offset + offset;
+    rect.h = height + offset + offset;
+    SDL_SetRenderDrawColor(surface, color.r, color.g, color.b, 255);
+    SDL_RenderDrawRect(surface, &rect);
+}
+
+void drawBorder(SDL_Renderer *surface, int n_cx, int n_cy, int len, int height, int thickness, const SDL_Color color){
+    for (int i = 0; i < thickness; ++i)
+        drawBox(surface, n_cx , n_cy, len, height, i, color);
+}
+
+bool is_visible(Node* node){
+    int x = node->pos.x - RENDER_ORIGIN.x;
+    int y = node->pos.y - RENDER_ORIGIN.y;
+    if (x < -OFFSCREEN_PADDING ||
+        x > APP.window_size.x + OFFSCREEN_PADDING ||
+        y < -OFFSCREEN_PADDING ||
+        y > APP.window_size.y + OFFSCREEN_PADDING )
+        return false;
+    return true;
+}
+
+/* red ring for unselected nodes, green for selected */
+SDL_Color nodeBorderColor(Node* node){
+    if (node == CUT)
+        return CUT_COLOR;
+    else if (node == COPY)
+        return COPY_COLOR;
+    else if (node->marked)
+        return MARKED_COLOR;
+    else if (SEARCH_RESULTS && SEARCH_RESULTS->num > 0 && node->search_mark == SEARCH_STAMP)
+        return SEARCH_COLOR;
+    else if (node == GRAPH.selected)
+        return SELECTED_COLOR;
+    else
+        return UNSELECTED_COLOR;
+}
+
+/* Renders a single node and the line to its parent, relative to RENDER_ORIGIN */
+void drawNodeItem(Node* node, bool hints) {
+    logPrint("drawNodeItem(%p)\n", node);
+    int x = node->pos.x - RENDER_ORIGIN.x;
+    int y = node->pos.y - RENDER_ORIGIN.y;
+    int width  = getWidth(node->text.buf, true) * GRAPH_SCALE;
+    int height = nodeTextHeight(node->text.buf) * GRAPH_SCALE;
+    if ( is_visible(node) )
+        drawBorder(APP.renderer, x, y, width, height, THICKNESS, nodeBorderColor(node));
+
+    /* draw edges between parent and child nodes */
+    if (node != GRAPH.root && (is_visible(node->p) || is_visible(node)) ){
+        SDL_SetRenderDrawColor(APP.renderer, EDGE_COLOR.r, EDGE_COLOR.g, EDGE_COLOR.b, 255);
+        SDL_RenderDrawLine(APP.renderer, x, y - (height*GRAPH_SCALE/2), node->p->pos.x - RENDER_ORIGIN.x, node->p->pos.y - RENDER_ORIGIN.y + (nodeTextHeight(node->p->text.buf) * GRAPH_SCALE / 2));
+    }
+
+    if ( is_visible(node) ){
+        Point message_pos;
+        message_pos.x = x - (width / 2);
+        message_pos.y = y - (height / 2);
+
+        /* render node text, scrolled to the cursor while it is edited */
+        bool edited = &node->text == CURRENT_BUFFER;
+        renderLines(node->text.buf, message_pos, GRAPH_SCALE, EDIT_COLOR, 1, edited, edited ? editScroll(node->text.buf) : 0, MAX_NODE_LINES);
+        int hidden = getHeight(node->text.buf, true) / TEXTBOX_HEIGHT - MAX_NODE_LINES;
+        if ( hidden > 0 ){
+            char more[24];
+            snprintf(more, sizeof(more), "+%d lines", hidden);
+            Point more_pos = {x + (width / 2) - (int) (strlen(more) * TEXTBOX_WIDTH_SCALE * 0.5 * GRAPH_SCALE), y + (height / 2) + THICKNESS};
+            renderMessage(more, more_pos, 0.5 * GRAPH_SCALE, EDGE_COLOR, 0, 0);
+        }
+        /* show how much is still folded away below nodes that are not loaded yet */
+        if ( node->lazy_next >= 0 ){
+            char folded[24];
+            snprintf(folded, sizeof(folded), "+%lld", node->lazy_end - node->lazy_next + 1);
+            Point folded_pos = {x - (width / 2), y + (height / 2) + THICKNESS};
+            renderMessage(folded, folded_pos, 0.5 * GRAPH_SCALE, EDGE_COLOR, 0, 0);
+        }
+        /* render hint text */
+        if ( hints && isHintMode(MODE) && node->hint_stamp == HINT_STAMP && strlen(node->hint_text) > 0 ){
+            // dont render hint text that doesn't match hint buffer
+            bool render_hint = true;
+            if (HINT_BUFFER.len > 0){
+                for (int i = 0; i < HINT_BUFFER.len; ++i) {
+                    if ( HINT_BUFFER.buf[i] != node->hint_text[i] ){
+                        render_hint = false;
+                        break;
+                    }
+                }
+            }
+            // position char in top left of node
+            if ( render_hint ) {
+                message_pos.x = x - (int)(width/ 2) - THICKNESS;
+                message_pos.y = y  - (int)(height/ 2) - THICKNESS - (RADIUS * GRAPH_SCALE);
+                renderMessage(node->hint_text, message_pos, 0.75 * GRAPH_SCALE, HINT_COLOR, 0, 0);
+            }
+        }
+    }
+
+}
+
+/* Renders each node before it's children, along with the lines to their parents */
+void drawNode(Node* node) {
+    logPrint("drawNode(%p)\n", node);
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); )
+        if ( walk.pre )
+            drawNodeItem(cur, true);
+    walkEnd(&walk);
+    logPrint("Finished drawing %p\n", node);
+}
+
+/* re-computes graph and draws everything onto renderer */
+void prepareScene() {
+    logPrint("start prepareScene()\n");
+    SDL_SetRenderDrawColor(APP.renderer, BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b, 255); /* Background color */
+    SDL_RenderClear(APP.renderer);
+
+    logPrint("Rendered\n");
+    // recompute the coordinates of each node in the tree
+    calculatePositions(GRAPH.root, GRAPH.selected);
+    logPrint("calculatePositions\n");
+
+    // Draw Graph
+    drawNode(GRAPH.root);
+    logPrint("drawNode\n");
+
+    // Draw filename
+    Point filename_pos;
+    filename_pos.x = (int) ((0.0) * APP.window_size.x);
+    filename_pos.y = (int) ((1.0) * APP.window_size.y - (TEXTBOX_HEIGHT * UI_SCALE));
+
+    char FILENAME_MESSAGE[2048];
+    strcpy(FILENAME_MESSAGE, FILENAME_BUFFER.buf);
+    if ( unwritten ){
+        strcpy( FILENAME_MESSAGE + FILENAME_BUFFER.len, "*");
+    }
+    renderMessage(FILENAME_MESSAGE, filename_pos, UI_SCALE, EDIT_COLOR, 0, &FILENAME_BUFFER == CURRENT_BUFFER);
+
+    // Draw the size of the selected subtree above the filename
+    if ( GRAPH.selected->height ){
+        char subtree_message[96];
+        snprintf(subtree_message, sizeof(subtree_message), "%zu nodes, %zu leaves, %d levels below",
+                 GRAPH.selected->size, GRAPH.selected->leaves, GRAPH.selected->height);
+        Point subtree_pos = {filename_pos.x, filename_pos.y - (int) (TEXTBOX_HEIGHT * UI_SCALE * 0.5)};
+        renderMessage(subtree_message, subtree_pos, 0.5 * UI_SCALE, EDIT_COLOR, 0, 0);
+    }
+    drawOpenJobs(filename_pos);
+
+
+    // Draw mode
+    Point mode_text_pos;
+    mode_text_pos.x = (int) ((0.0) * APP.window_size.x);
+    mode_text_pos.y = (int) ((0.0) * APP.window_size.y);
+    renderMessage(PASTE_AFTER ? "PASTE AFTER" : getModeName(MODE), mode_text_pos, UI_SCALE, EDIT_COLOR, 0, 0);
+    if ( MODE == Conflict ){
+        mode_text_pos.y += TEXTBOX_HEIGHT * UI_SCALE;
+        renderMessage("file changed on disk, r: reload it, k: keep this version", mode_text_pos, UI_SCALE, EDIT_COLOR, 0, 0);
+    }
+
+    //Draw hint buffer
+    Point hint_buf_pos;
+    hint_buf_pos.x = (int) ((1.0 * APP.window_size.x) - (HINT_BUFFER.len * TEXTBOX_WIDTH_SCALE * UI_SCALE));
+    hint_buf_pos.y = (int) ((1.0) * APP.window_size.y - (TEXTBOX_HEIGHT * UI_SCALE));
+    renderMessage(HINT_BUFFER.buf, hint_buf_pos, UI_SCALE, HINT_COLOR, 0, 0);
+
+    // Draw search query and results, labelled with their hints once jumpable
+    if ( MODE == Search || MODE == SearchJump ){
+        Point search_pos;
+        search_pos.x = 0;
+        search_pos.y = (int) (TEXTBOX_HEIGHT * UI_SCALE);
+        renderMessage(SEARCH_BUFFER.len ? SEARCH_BUFFER.buf : " ", search_pos, UI_SCALE, SEARCH_COLOR, 0, &SEARCH_BUFFER == CURRENT_BUFFER);
+        char result_line[64];
+        for (int i = 0; i < SEARCH_RESULTS->num; i++) {
+            Node* result = SEARCH_RESULTS->array[i];
+            snprintf(result_line, sizeof(result_line), "%-3s%.*s", MODE == SearchJump ? result->hint_text : "", NUM_CHARS_B4_WRAP, result->text.buf);
+            replaceChar(result_line, '\n', ' ');
+            search_pos.y += (int) (TEXTBOX_HEIGHT * UI_SCALE * 0.75);
+            renderMessage(result_line, search_pos, 0.75 * UI_SCALE, MODE == SearchJump ? HINT_COLOR : EDIT_COLOR, 0, 0);
+        }
+    }
+
+    if ( MINIMAP_SHOWN )
+        drawMinimap();
+
+    if ( MEMORY_OVERLAY )
+        drawMemoryOverlay();
+
+    if ( TOGGLE_MODE ){
+        Point toggle_indicator_pos;
+        toggle_indicator_pos.x = (int) ((1.0 * APP.window_size.x) - (strlen(TOGGLE_INDICATOR) * TEXTBOX_WIDTH_SCALE * UI_SCALE));
+        toggle_indicator_pos.y = (int) ((0.0) * APP.window_size.y);
+        renderMessage(TOGGLE_INDICATOR, toggle_indicator_pos, 1.0, EDIT_COLOR, 0, 0);
+    }
+}
+
+/* actually renders the screen */
+void presentScene() {
+    SDL_RenderPresent(APP.renderer);
+    latencyPresented();
+}
+
+
+// MINIMAP
+
+/* An overview of the whole layout in a corner of the window. The tree is
+ * drawn once into a small texture, in coordinates relative to the root so that
+ * moving the selection does not change it, and redrawn only once the layout
+ * has been redone for a newer LAYOUT_VERSION. Each frame then only copies the
+ * texture and draws the viewport and the selected node on top. */
+typedef struct Minimap Minimap;
+struct Minimap {
+    SDL_Texture* texture;           // belongs to APP.renderer, see minimapReset
+    unsigned int version;           // LAYOUT_VERSION + 1 of the layout the texture shows, 0 to redraw
+    int bounds[4];                  // tree bounds relative to the root
+    double scale;                   // minimap pixels per tree pixel
+    SDL_Rect rect;                  // where the minimap is on screen
+};
+static Minimap MINIMAP;
+
+// target textures lose their contents when the renderer resets them
+void minimapInvalidate(){
+    MINIMAP.version = 0;
+}
+
+// textures die with their renderer, so this is called before APP.renderer is destroyed or replaced
+void minimapReset(){
+    if ( MINIMAP.texture ) SDL_DestroyTexture(MINIMAP.texture);
+    MINIMAP.texture = NULL;
+    MINIMAP.version = 0;
+}
+
+// maps a window position to the minimap, origin is the top left of the minimap
+static Point minimapPoint(int x, int y, Point origin){
+    Point point;
+    point.x = origin.x + (int) ((x - GRAPH.root->pos.x - MINIMAP.bounds[0]) * MINIMAP.scale);
+    point.y = origin.y + (int) ((y - GRAPH.root->pos.y - MINIMAP.bounds[1]) * MINIMAP.scale);
+    return point;
+}
+
+static void minimapRenderNode(Node* node){
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); ) {
+        if ( !walk.pre ) continue;
+        Point origin = {0, 0};
+        Point center = minimapPoint(cur->pos.x, cur->pos.y, origin);
+        if ( cur != GRAPH.root ){
+            Point parent = minimapPoint(cur->p->pos.x, cur->p->pos.y, origin);
+            SDL_SetRenderDrawColor(APP.renderer, EDGE_COLOR.r / 2, EDGE_COLOR.g / 2, EDGE_COLOR.b / 2, 255);
+            SDL_RenderDrawLine(APP.renderer, parent.x, parent.y, center.x, center.y);
+        }
+        SDL_Rect box;
+        box.w = max(1, (int) (getWidth(cur->text.buf, true) * GRAPH_SCALE * MINIMAP.scale));
+        box.h = max(1, (int) (nodeTextHeight(cur->text.buf) * GRAPH_SCALE * MINIMAP.scale));
+        box.x = center.x - box.w / 2;
+        box.y = center.y - box.h / 2;
+        SDL_SetRenderDrawColor(APP.renderer, EDIT_COLOR.r, EDIT_COLOR.g, EDIT_COLOR.b, 255);
+        SDL_RenderFillRect(APP.renderer, &box);
+    }
+    walkEnd(&walk);
+}
+
+// redraws the texture if the layout changed since it was drawn
+static void minimapUpdate(){
+    // while a layout is pending the old picture stays up, unless there is none yet
+    if ( MINIMAP.texture && (MINIMAP.version == LAYOUT_VERSION + 1 || (MINIMAP.version && LAYOUT_DIRTY)) )
+        return;
+    if ( !MINIMAP.texture ){
+        MINIMAP.texture = SDL_CreateTexture(APP.renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_TARGET, MINIMAP_WIDTH, MINIMAP_HEIGHT);
+        if ( !MINIMAP.texture ) return;
+    }
+    int bounds[4] = {GRAPH.root->pos.x, GRAPH.root->pos.y, GRAPH.root->pos.x, GRAPH.root->pos.y};
+    exportBounds(GRAPH.root, bounds);
+    for (int i = 0; i < 4; i++)
+        MINIMAP.bounds[i] = bounds[i] - (i % 2 ? GRAPH.root->pos.y : GRAPH.root->pos.x);
+    double x_scale = (double) MINIMAP_WIDTH / max(1, bounds[2] - bounds[0]);
+    double y_scale = (double) MINIMAP_HEIGHT / max(1, bounds[3] - bounds[1]);
+    MINIMAP.scale = x_scale < y_scale ? x_scale : y_scale;
+
+    SDL_SetRenderTarget(APP.renderer, MINIMAP.texture);
+    SDL_SetRenderDrawColor(APP.renderer, BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b, 255);
+    SDL_RenderClear(APP.renderer);
+    minimapRenderNode(GRAPH.root);
+    SDL_SetRenderTarget(APP.renderer, NULL);
+    MINIMAP.version = LAYOUT_DIRTY ? 0 : LAYOUT_VERSION + 1;
+}
+
+// bottom right, above the hint buffer
+void drawMinimap(){
+    minimapUpdate();
+    if ( !MINIMAP.texture ) return;
+    MINIMAP.rect.w = MINIMAP_WIDTH;
+    MINIMAP.rect.h = MINIMAP_HEIGHT;
+    MINIMAP.rect.x = APP.window_size.x - MINIMAP_WIDTH - THICKNESS;
+    MINIMAP.rect.y = APP.window_size.y - MINIMAP_HEIGHT - THICKNESS - (int) (TEXTBOX_HEIGHT * UI_SCALE);
+    SDL_RenderCopy(APP.renderer, MINIMAP.texture, NULL, &MINIMAP.rect);
+
+    Point origin = {MINIMAP.rect.x, MINIMAP.rect.y};
+    Point top_left = minimapPoint(0, 0, origin);
+    Point bottom_right = minimapPoint(APP.window_size.x, APP.window_size.y, origin);
+    SDL_Rect viewport = {top_left.x, top_left.y, bottom_right.x - top_left.x, bottom_right.y - top_left.y};
+    SDL_Rect clipped;
+    SDL_SetRenderDrawColor(APP.renderer, SELECTED_COLOR.r, SELECTED_COLOR.g, SELECTED_COLOR.b, 255);
+    if ( SDL_IntersectRect(&viewport, &MINIMAP.rect, &clipped) )
+        SDL_RenderDrawRect(APP.renderer, &clipped);
+    Point selected = minimapPoint(GRAPH.selected->pos.x, GRAPH.selected->pos.y, origin);
+    SDL_Rect dot = {selected.x - 2, selected.y - 2, 5, 5};
+    SDL_RenderFillRect(APP.renderer, &dot);
+    SDL_SetRenderDrawColor(APP.renderer, EDGE_COLOR.r, EDGE_COLOR.g, EDGE_COLOR.b, 255);
+    SDL_RenderDrawRect(APP.renderer, &MINIMAP.rect);
+}
+
+static void minimapNearest(Node* node, int x, int y, Node** nearest, long long* distance){
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); ) {
+        if ( !walk.pre ) continue;
+        long long dx = cur->pos.x - GRAPH.root->pos.x - x, dy = cur->pos.y - GRAPH.root->pos.y - y;
+        if ( dx * dx + dy * dy < *distance ){
+            *distance = dx * dx + dy * dy;
+            *nearest = cur;
         }
     }
+    walkEnd(&walk);
+}
+
+// selects the node closest to a click on the minimap, returns false if the click missed it
+bool minimapClick(int x, int y){
+    SDL_Point point = {x, y};
+    if ( !MINIMAP_SHOWN || !MINIMAP.texture || !SDL_PointInRect(&point, &MINIMAP.rect) )
+        return false;
+    Node* nearest = GRAPH.root;
+    long long distance = LLONG_MAX;
+    minimapNearest(GRAPH.root, MINIMAP.bounds[0] + (int) ((x - MINIMAP.rect.x) / MINIMAP.scale),
+                   MINIMAP.bounds[1] + (int) ((y - MINIMAP.rect.y) / MINIMAP.scale), &nearest, &distance);
+    GRAPH.selected = nearest;
+    return true;
+}
+
+
+// INPUT LATENCY
+/* The time from an input event, by its SDL timestamp, until the frame that shows its
+ * effect has been presented, which waits for vsync when the renderer does. Inputs
+ * handled before the same frame are timed from the oldest one. */
+static bool INPUT_PENDING = false;          // an input has not been presented yet
+static Uint32 INPUT_TIMESTAMP = 0;          // of the oldest such input
+static Uint32 LATENCY[LATENCY_SAMPLES];     // ring of the latest latencies, in ms
+static size_t LATENCY_NUM = 0;              // latencies measured in all
+
+// called by the event loop with each event it handles
+void latencyInput(SDL_Event* event){
+    switch (event->type){
+        case SDL_KEYDOWN: case SDL_TEXTINPUT: case SDL_MOUSEBUTTONDOWN:
+            if ( INPUT_PENDING ) break;
+            INPUT_PENDING = true;
+            INPUT_TIMESTAMP = event->common.timestamp;
+            break;
+        default: break;
+    }
+}
+
+void latencyPresented(){
+    if ( !INPUT_PENDING ) return;
+    INPUT_PENDING = false;
+    LATENCY[LATENCY_NUM++ % LATENCY_SAMPLES] = SDL_GetTicks() - INPUT_TIMESTAMP;
+}
+
+static int compareLatency(const void* a, const void* b){
+    Uint32 x = *(const Uint32*) a, y = *(const Uint32*) b;
+    return (x > y) - (x < y);
+}
+
+// writes percentiles of the latest latencies, nothing before the first input
+void latencyReport(FILE* file){
+    size_t num = LATENCY_NUM < LATENCY_SAMPLES ? LATENCY_NUM : LATENCY_SAMPLES;
+    if ( !num ) return;
+    Uint32 sorted[LATENCY_SAMPLES];
+    memcpy(sorted, LATENCY, num * sizeof(Uint32));
+    qsort(sorted, num, sizeof(Uint32), compareLatency);
+    fprintf(file, "input to present: p50 %u ms, p90 %u ms, p99 %u ms, max %u ms over the last %zu of %zu inputs\n",
+            sorted[num / 2], sorted[num * 9 / 10], sorted[num * 99 / 100], sorted[num - 1], num, LATENCY_NUM);
+}
+
+
+// MEMORY STATISTICS
+typedef struct MemWaste MemWaste;
+struct MemWaste {
+    size_t nodes;
+    size_t text_unused;         // bytes of text buffers past the end of the text
+    size_t child_slots_unused;  // bytes of child arrays not holding a child
+    size_t text_inline;         // nodes holding their text in text_inline
+};
+
+void memWaste(Node* node, MemWaste* waste){
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); ) {
+        if ( !walk.pre ) continue;
+        waste->nodes++;
+        // measured against what the allocator reserved, like MEM_STATS
+        if ( cur->text.size )  // shared text is sized to fit, only an edited node's buffer has room to spare
+            waste->text_unused += malloc_usable_size(cur->text.buf) - cur->text.len - 1;
+        waste->child_slots_unused += malloc_usable_size(cur->children->array) - cur->children->num * sizeof(void*);
+        waste->text_inline += nodeTextInline(cur);
+    }
+    walkEnd(&walk);
+}
+
+static double percentOf(size_t part, size_t whole){
+    return whole ? 100.0 * part / whole : 0;
+}
+
+// writes live and peak allocations per subsystem, then what the tree costs per node
+void memReport(FILE* file){
+    MemStats total = {0};
+    fprintf(file, "%-12s %12s %9s %12s %9s %10s\n", "subsystem", "live bytes", "live", "peak bytes", "peak", "allocs");
+    for (int tag = 0; tag < MEM_TAGS; tag++) {
+        MemStats* stats = &MEM_STATS[tag];
+        fprintf(file, "%-12s %12zu %9zu %12zu %9zu %10zu\n", MEM_TAG_NAMES[tag],
+                stats->live_bytes, stats->live_count, stats->peak_bytes, stats->peak_count, stats->allocs);
+        total.live_bytes += stats->live_bytes;
+        total.live_count += stats->live_count;
+        total.allocs += stats->allocs;
+    }
+    fprintf(file, "%-12s %12zu %9zu %12s %9s %10zu\n", "total", total.live_bytes, total.live_count, "", "", total.allocs);
+
+    MemWaste waste = {0};
+    memWaste(GRAPH.root, &waste);
+    size_t tree_bytes = MEM_STATS[MemNodes].live_bytes + MEM_STATS[MemChildren].live_bytes
+                      + MEM_STATS[MemText].live_bytes;
+    fprintf(file, "%zu nodes, %.1f bytes per node (node, child array, text)\n",
+            waste.nodes, (double) tree_bytes / waste.nodes);
+    fprintf(file, "unused: text %zu (%.0f%%), child slots %zu (%.0f%%)\n",
+            waste.text_unused, percentOf(waste.text_unused, MEM_STATS[MemText].live_bytes),
+            waste.child_slots_unused, percentOf(waste.child_slots_unused, MEM_STATS[MemChildren].live_bytes));
+    fprintf(file, "interned text: %zu distinct strings shared by %zu nodes, %zu nodes hold their text inline\n",
+            INTERN_COUNT, INTERN_REFS, waste.text_inline);
+    fprintf(file, "malloc chunk headers ~%zu\n", total.live_count * sizeof(size_t));
+}
+
+// draws memReport below the mode name, one line at a time
+void drawMemoryOverlay(){
+    char report[4096];
+    FILE* file = fmemopen(report, sizeof(report), "w");
+    if ( !file ) return;
+    memReport(file);
+    latencyReport(file);
+    fclose(file);
+    report[sizeof(report) - 1] = '\0';
+    Point pos = {0, (int) (TEXTBOX_HEIGHT * UI_SCALE)};
+    for (char* line = strtok(report, "\n"); line; line = strtok(NULL, "\n")) {
+        renderMessage(line, pos, 0.5 * UI_SCALE, EDIT_COLOR, 0, 0);
+        pos.y += (int) (TEXTBOX_HEIGHT * UI_SCALE * 0.5);
+    }
+}
+
+
+// RECORD AND REPLAY
+// A recording holds one line per event given to eventHandler, after a header with the window size:
+//   <ms since start> t <hex bytes of the text>
+//   <ms since start> d|u <keycode> <modifiers> <repeat>
+//   <ms since start> r <width> <height>
+//   <ms since start> b <x> <y>             (mouse button press)
+//   <ms since start> q
+typedef struct ReplaySample ReplaySample;
+struct ReplaySample {
+    enum Mode mode;             // mode the event arrived in
+    double process_ms;          // eventHandler and journal upkeep
+    double render_ms;           // prepareScene and presentScene
+};
+
+static FILE* RECORD_FILE = NULL;
+static Uint32 RECORD_START;
+
+bool recordBegin(char* path){
+    RECORD_FILE = fopen(path, "w");
+    if ( !RECORD_FILE ){
+        fprintf(stderr, "Could not record to %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    RECORD_START = SDL_GetTicks();
+    fprintf(RECORD_FILE, "dtree-events 1 %d %d\n", APP.window_size.x, APP.window_size.y);
+    return true;
+}
+
+void recordEvent(SDL_Event* event){
+    if ( !RECORD_FILE ) return;
+    Uint32 time = SDL_GetTicks() - RECORD_START;
+    switch (event->type){
+        case SDL_TEXTINPUT:
+            fprintf(RECORD_FILE, "%u t ", time);
+            for (unsigned char* c = (unsigned char*) event->text.text; *c; c++)
+                fprintf(RECORD_FILE, "%02x", *c);
+            fputc('\n', RECORD_FILE);
+            break;
+        case SDL_KEYDOWN: case SDL_KEYUP:
+            fprintf(RECORD_FILE, "%u %c %d %d %d\n", time, event->type == SDL_KEYDOWN ? 'd' : 'u',
+                    (int) event->key.keysym.sym, (int) event->key.keysym.mod, (int) event->key.repeat);
+            break;
+        case SDL_WINDOWEVENT:
+            if ( event->window.event == SDL_WINDOWEVENT_RESIZED )
+                fprintf(RECORD_FILE, "%u r %d %d\n", time, event->window.data1, event->window.data2);
+            break;
+        case SDL_MOUSEBUTTONDOWN:
+            fprintf(RECORD_FILE, "%u b %d %d\n", time, event->button.x, event->button.y);
+            break;
+        case SDL_QUIT:
+            fprintf(RECORD_FILE, "%u q\n", time);
+            break;
+        default:
+            return;
+    }
+    // a session that crashes is the one worth replaying
+    fflush(RECORD_FILE);
 }
 
-void calculateMaxHeights(Node* node, int level, int* max_heights) {
-    int node_height = getHeight(node->text.buf, true) * GRAPH_SCALE +RADIUS;
-    if (node_height > max_heights[level]) {
-        max_heights[level] = node_height;
-    }
-    for(int i = 0; i < node->children->num; i++) {
-        calculateMaxHeights(node->children->array[i], level+1, max_heights);
+void recordEnd(){
+    if ( RECORD_FILE ){
+        fclose(RECORD_FILE);
+        latencyReport(stdout);
     }
+    RECORD_FILE = NULL;
 }
 
-// recursive helper function for calculatePositions
-// accumulates offsets to assign correct [x,y] values to each node
-void applyOffsets(Node* node, int x_offset, int level, int* y_levels) {
-    node->pos.x = x_offset + APP.window_size.x/2;
-    if (level > 0) {
-        node->pos.y = node->p->pos.y + y_levels[level-1]/2 + y_levels[level]/2;
-    }
-    for (int i = 0; i < node->children->num; i++) {
-        Node* child = node->children->array[i];
-        applyOffsets(child, x_offset + child->x_offset, level+1, y_levels);
+// parses one recorded line into event, returns false for lines that are not events
+bool replayParse(char* line, SDL_Event* event){
+    unsigned int time;
+    char type;
+    int consumed;
+    if ( sscanf(line, "%u %c%n", &time, &type, &consumed) < 2 ) return false;
+    char* rest = line + consumed;
+    memset(event, 0, sizeof(SDL_Event));
+    event->common.timestamp = time;
+    switch (type){
+        case 't': {
+            event->type = SDL_TEXTINPUT;
+            while ( *rest == ' ' ) rest++;
+            size_t len = 0;
+            unsigned int byte;
+            while ( len + 1 < sizeof(event->text.text) && sscanf(rest, "%2x", &byte) == 1 ){
+                event->text.text[len++] = (char) byte;
+                rest += 2;
+            }
+            return len > 0;
+        }
+        case 'd': case 'u': {
+            int sym, mod, repeat;
+            if ( sscanf(rest, "%d %d %d", &sym, &mod, &repeat) != 3 ) return false;
+            event->type = type == 'd' ? SDL_KEYDOWN : SDL_KEYUP;
+            event->key.state = type == 'd' ? SDL_PRESSED : SDL_RELEASED;
+            event->key.keysym.sym = sym;
+            event->key.keysym.mod = mod;
+            event->key.repeat = repeat;
+            return true;
+        }
+        case 'r':
+            event->type = SDL_WINDOWEVENT;
+            event->window.event = SDL_WINDOWEVENT_RESIZED;
+            return sscanf(rest, "%d %d", &event->window.data1, &event->window.data2) == 2;
+        case 'b':
+            event->type = SDL_MOUSEBUTTONDOWN;
+            event->button.button = SDL_BUTTON_LEFT;
+            return sscanf(rest, "%d %d", &event->button.x, &event->button.y) == 2;
+        case 'q':
+            event->type = SDL_QUIT;
+            return true;
+        default:
+            return false;
     }
 }
 
-// shifts all node positions so that the selected node is at the center of the screen
-void centerOnSelected(Node* node, int selected_x, int selected_y) {
-    node->pos.x += APP.window_size.x/2 - selected_x;
-    node->pos.y += APP.window_size.y/2 - selected_y;
-    for (int i = 0; i < node->children->num; i++) {
-        Node* child = node->children->array[i];
-        centerOnSelected(child, selected_x, selected_y);
-    }
+// renders into a software surface of the recorded window size, there is no window to resize
+bool replayResize(SDL_Surface** surface, int width, int height){
+    minimapReset();
+    if ( APP.renderer ) SDL_DestroyRenderer(APP.renderer);
+    SDL_FreeSurface(*surface);
+    APP.renderer = NULL;
+    *surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGB888);
+    if ( *surface ) APP.renderer = SDL_CreateSoftwareRenderer(*surface);
+    APP.window_size.x = width;
+    APP.window_size.y = height;
+    return APP.renderer != NULL;
 }
 
-// recomputes the coordinates of the nodes (i.e. populates pos field)
-void calculatePositions(Node* root, Node* selected){
-    logPrint("calculatingPositions...\n");
-    int* y_levels = calloc(1+getDepth(root), sizeof(int));
+double replayMilliseconds(Uint64 start, Uint64 end){
+    return (double) (end - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
 
-    logPrint("Calculating offsets...\n");
-    calculateOffsets(root);
-    logPrint("Calculating y levels...\n");
-    calculateMaxHeights(root, 0, y_levels);
-    logPrint("Applying offsets...\n");
-    applyOffsets(root, 0, 0, y_levels);
-    logPrint("Centering...\n");
-    centerOnSelected(root, GRAPH.selected->pos.x, GRAPH.selected->pos.y);
-    logPrint("Positions calculated.\n");
+int compareDoubles(const void* a, const void* b){
+    double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
 
-    free(y_levels);
+// nearest rank percentile of sorted values
+double percentile(double* sorted, size_t num, double p){
+    size_t rank = (size_t) (p / 100.0 * num + 0.999999);
+    return sorted[rank ? rank - 1 : 0];
 }
 
-/* Debug function, used to print locations of all nodes in indented hierarchy */
-// dead code
-void recursivelyPrintPositions(Node* node, int level){
-    for (int i=0; i<level; i++){
-        logPrint("\t");
+// prints p50/p90/p99/max of one latency for the samples of a mode, or of all samples if mode is -1
+void replayReportLine(FILE* file, ReplaySample* samples, size_t num, int mode, char* name){
+    double* process = memMalloc(MemOther, (num ? num : 1) * sizeof(double));
+    double* render = memMalloc(MemOther, (num ? num : 1) * sizeof(double));
+    size_t count = 0;
+    for (size_t i = 0; i < num; i++) {
+        if ( mode >= 0 && samples[i].mode != (enum Mode) mode ) continue;
+        process[count] = samples[i].process_ms;
+        render[count++] = samples[i].render_ms;
     }
-    logPrint("%d %d\n",node->pos.x, node->pos.y);
-
-    for (int i = 0; i < node->children->num; i++) {
-        recursivelyPrintPositions(node->children->array[i], level + 1);
+    if ( count ){
+        qsort(process, count, sizeof(double), compareDoubles);
+        qsort(render, count, sizeof(double), compareDoubles);
+        fprintf(file, "%-14s %7zu  %8.3f %8.3f %8.3f %8.3f  %8.3f %8.3f %8.3f %8.3f\n", name, count,
+                percentile(process, count, 50), percentile(process, count, 90),
+                percentile(process, count, 99), process[count - 1],
+                percentile(render, count, 50), percentile(render, count, 90),
+                percentile(render, count, 99), render[count - 1]);
     }
+    memFree(MemOther, process);
+    memFree(MemOther, render);
 }
 
+// feeds a recording to eventHandler as fast as possible, rendering a frame after each event
+// like the main loop does, and reports latency percentiles per mode
+bool replayEvents(char* path){
+    FILE* input = fopen(path, "r");
+    if ( !input ){
+        fprintf(stderr, "Could not replay %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    char* line = NULL;
+    size_t line_size = 0;
+    int width = SCREEN_WIDTH, height = SCREEN_HEIGHT;
+    if ( getline(&line, &line_size, input) < 0 || sscanf(line, "dtree-events 1 %d %d", &width, &height) != 2 ){
+        fprintf(stderr, "%s is not a dtree recording\n", path);
+        free(line);
+        fclose(input);
+        return false;
+    }
+    SDL_Surface* surface = NULL;
+    if ( !replayResize(&surface, width, height) ){
+        fprintf(stderr, "Could not create a renderer for replay: %s\n", SDL_GetError());
+        free(line);
+        fclose(input);
+        return false;
+    }
 
-// RENDERING
-void renderMessage(char* message, Point pos, double scale, SDL_Color color, bool wrap, bool cursor){
-    if (!message) return;
+    REPLAYING = true;
+    size_t num = 0, capacity = 1024;
+    ReplaySample* samples = memMalloc(MemOther, capacity * sizeof(ReplaySample));
+    SDL_Event event;
+    while ( !APP.quit && getline(&line, &line_size, input) >= 0 ) {
+        if ( !replayParse(line, &event) ) continue;
+        if ( event.type == SDL_QUIT ) break;
+        if ( num == capacity ){
+            capacity *= 2;
+            samples = memRealloc(MemOther, samples, capacity * sizeof(ReplaySample));
+        }
+        ReplaySample* sample = &samples[num++];
+        sample->mode = MODE;
 
-    char** lines = getLines(message, wrap);
-    int cur_line = 0;
-    int len_so_far = 0 ;
-    while(lines[cur_line]) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        if ( event.type == SDL_WINDOWEVENT )
+            replayResize(&surface, event.window.data1, event.window.data2);
+        else
+            eventHandler(&event);
+        journalMaybeCompact();
+        Uint64 handled = SDL_GetPerformanceCounter();
+        prepareScene();
+        presentScene();
+        Uint64 rendered = SDL_GetPerformanceCounter();
 
-        // create surface from string
-        SDL_Surface* surface_message;
-        surface_message = TTF_RenderText_Solid(FONT, lines[cur_line], color);
+        sample->process_ms = replayMilliseconds(start, handled);
+        sample->render_ms = replayMilliseconds(handled, rendered);
+    }
+    REPLAYING = false;
+    free(line);
+    fclose(input);
+
+    printf("replayed %zu events from %s at %dx%d, latencies in ms\n", num, path, width, height);
+    printf("%-14s %7s  %8s %8s %8s %8s  %8s %8s %8s %8s\n", "mode", "events",
+           "proc p50", "p90", "p99", "max", "draw p50", "p90", "p99", "max");
+    for (int mode = 0; getModeName(mode); mode++)
+        replayReportLine(stdout, samples, num, mode, getModeName(mode));
+    replayReportLine(stdout, samples, num, -1, "ALL");
+
+    memFree(MemOther, samples);
+    minimapReset();
+    SDL_DestroyRenderer(APP.renderer);
+    SDL_FreeSurface(surface);
+    APP.renderer = NULL;
+    return true;
+}
 
-        // now you can convert it into a texture
-        SDL_Texture* texture_message = SDL_CreateTextureFromSurface(APP.renderer, surface_message);
 
-        SDL_Rect message_rect;
-        message_rect.x = pos.x;
-        message_rect.y = pos.y + (TEXTBOX_HEIGHT * cur_line * GRAPH_SCALE);
-        message_rect.w = strlen(lines[cur_line]) * TEXTBOX_WIDTH_SCALE * scale;
-        message_rect.h = TEXTBOX_HEIGHT * scale;
+// EXPORT
+/*
+ * Whole trees are exported without a full-resolution framebuffer. The layout
+ * is computed once, then the image is cut into strips of EXPORT_TILE_HEIGHT
+ * rows and each strip into tiles, which are drawn with drawNodeItem into a
+ * single offscreen software renderer. A finished strip is staged in a
+ * temporary file and streamed into the PNG encoder, so memory stays at one
+ * tile however large the tree is. SVG is written straight from node geometry.
+ */
+typedef struct ExportItem ExportItem;
+struct ExportItem {
+    Node* node;
+    int x0, x1;             // horizontal extent of the node and its parent edge
+    int y0, y1;             // vertical extent, see nodeExtent
+};
 
-        SDL_SetRenderDrawColor(APP.renderer, BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b, 255);
-        SDL_RenderFillRect(APP.renderer, &message_rect);
-        logPrint("Rendering %s %d %d\n", message, message_rect.w, message_rect.h);
-        SDL_RenderCopy(APP.renderer, texture_message, NULL, &message_rect);
+/*
+ * Minimal streaming PNG encoder: the image data is one fixed-Huffman deflate
+ * block that only uses matches at distance 3, i.e. runs of the previous
+ * pixel, which is enough to squeeze the background between nodes.
+ */
+typedef struct PngWriter PngWriter;
+struct PngWriter {
+    FILE* file;
+    unsigned long adler_a, adler_b;
+    unsigned long bits;     // pending output bits, least significant first
+    int num_bits;
+    unsigned char history[3];   // last pixel written, for run detection
+    size_t position;
+    size_t run;             // bytes equal to the byte three before them
+    int len;
+    unsigned char out[65536];
+};
 
-        // draw cursor (the int cast is required)
-        if (cursor && len_so_far <= CURSOR_POSITION + 1 && CURSOR_POSITION < len_so_far + (int) strlen(lines[cur_line]) ){
-            int cursor_offset = (CURSOR_POSITION + 1 - len_so_far) * TEXTBOX_WIDTH_SCALE * GRAPH_SCALE;
-            SDL_SetRenderDrawColor(APP.renderer, EDIT_COLOR.r, EDIT_COLOR.g, EDIT_COLOR.b, 255);
-            SDL_RenderDrawLine(APP.renderer, message_rect.x + cursor_offset, message_rect.y, message_rect.x + cursor_offset, message_rect.y + (TEXTBOX_HEIGHT * GRAPH_SCALE));
+static const int DEFLATE_LENGTH_BASE[30] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 259};
+static const int DEFLATE_LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                             3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static unsigned long CRC_TABLE[256];
+
+unsigned long crc32Update(unsigned long crc, unsigned char* buf, size_t len){
+    if ( !CRC_TABLE[1] ){
+        for (unsigned long n = 0; n < 256; n++) {
+            unsigned long c = n;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xedb88320UL ^ (c >> 1) : c >> 1;
+            CRC_TABLE[n] = c;
         }
+    }
+    crc ^= 0xffffffffUL;
+    for (size_t i = 0; i < len; i++)
+        crc = CRC_TABLE[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffUL;
+}
+
+void putBigEndian(unsigned char* out, unsigned long value){
+    out[0] = value >> 24; out[1] = value >> 16; out[2] = value >> 8; out[3] = value;
+}
 
+void pngChunk(FILE* file, char* type, unsigned char* data, size_t len){
+    unsigned char word[4];
+    putBigEndian(word, len);
+    fwrite(word, 1, 4, file);
+    fwrite(type, 1, 4, file);
+    if ( len ) fwrite(data, 1, len, file);
+    putBigEndian(word, crc32Update(crc32Update(0, (unsigned char*) type, 4), data, len));
+    fwrite(word, 1, 4, file);
+}
 
-        SDL_FreeSurface(surface_message);
-        SDL_DestroyTexture(texture_message);
-        len_so_far += strlen(lines[cur_line]) + 1;
-        cur_line++;
+void pngFlush(PngWriter* png){
+    if ( png->len ) pngChunk(png->file, "IDAT", png->out, png->len);
+    png->len = 0;
+}
 
+void pngBits(PngWriter* png, unsigned long value, int count){
+    png->bits |= value << png->num_bits;
+    png->num_bits += count;
+    while ( png->num_bits >= 8 ){
+        png->out[png->len++] = png->bits & 0xff;
+        if ( png->len == (int) sizeof(png->out) ) pngFlush(png);
+        png->bits >>= 8;
+        png->num_bits -= 8;
     }
-    freeLines(lines);
 }
 
-void drawBox(SDL_Renderer *surface, int n_cx, int n_cy, int len, int height, int offset, const SDL_Color color){
-    SDL_Rect rect;
-    rect.x = (int) n_cx - ( len  / 2 )  - offset;
-    rect.y = (int) n_cy - ( height / 2 ) - offset;
-    rect.w = len + offset + offset;
-    rect.h = height + offset + offset;
-    SDL_SetRenderDrawColor(surface, color.r, color.g, color.b, 255);
-    SDL_RenderDrawRect(surface, &rect);
+// huffman codes are stored most significant bit first
+void pngCode(PngWriter* png, int code, int count){
+    int reversed = 0;
+    for (int i = 0; i < count; i++)
+        reversed |= ((code >> i) & 1) << (count - 1 - i);
+    pngBits(png, reversed, count);
 }
 
-void drawBorder(SDL_Renderer *surface, int n_cx, int n_cy, int len, int height, int thickness, const SDL_Color color){
-    for (int i = 0; i < thickness; ++i)
-        drawBox(surface, n_cx , n_cy, len, height, i, color);
+// fixed huffman code for a literal/length symbol
+void pngSymbol(PngWriter* png, int symbol){
+    if ( symbol < 144 )      pngCode(png, 0x30 + symbol, 8);
+    else if ( symbol < 256 ) pngCode(png, 0x190 + symbol - 144, 9);
+    else if ( symbol < 280 ) pngCode(png, symbol - 256, 7);
+    else                     pngCode(png, 0xc0 + symbol - 280, 8);
 }
 
-bool is_visible(Node* node){
-    if (node->pos.x < -OFFSCREEN_PADDING ||
-        node->pos.x > APP.window_size.x + OFFSCREEN_PADDING ||
-        node->pos.y < -OFFSCREEN_PADDING ||
-        node->pos.y > APP.window_size.y + OFFSCREEN_PADDING )
-        return false;
-    return true;
+void pngFlushRun(PngWriter* png){
+    while ( png->run >= 3 ){
+        int length = png->run < 258 ? png->run : 258;
+        if ( png->run - length > 0 && png->run - length < 3 ) length = png->run - 3;
+        int code = 0;
+        while ( DEFLATE_LENGTH_BASE[code + 1] <= length ) code++;
+        pngSymbol(png, 257 + code);
+        pngBits(png, length - DEFLATE_LENGTH_BASE[code], DEFLATE_LENGTH_EXTRA[code]);
+        pngCode(png, 2, 5);    // distance 3
+        png->run -= length;
+    }
+    // the run repeats the last pixel, so its leftover bytes are still in history
+    for (size_t i = png->position - png->run; i < png->position; i++)
+        pngSymbol(png, png->history[i % 3]);
+    png->run = 0;
 }
 
-/* Renders each node, then renders it's children and draws lines to the children */
-void drawNode(Node* node) {
-    if ( node == NULL ) return;
+void pngWrite(PngWriter* png, unsigned char* buf, size_t len){
+    for (size_t i = 0; i < len; i++) {
+        png->adler_a += buf[i];
+        if ( png->adler_a >= 65521 ) png->adler_a -= 65521;
+        png->adler_b += png->adler_a;
+        if ( png->adler_b >= 65521 ) png->adler_b -= 65521;
+        if ( png->position >= 3 && png->history[png->position % 3] == buf[i] )
+            png->run++;
+        else {
+            pngFlushRun(png);
+            pngSymbol(png, buf[i]);
+        }
+        png->history[png->position++ % 3] = buf[i];
+    }
+}
 
-    logPrint("drawNode(%p)\n", node);
-    int x = node->pos.x;
-    int y = node->pos.y;
-    logPrint("Children pointer: %p, num: %lu\n", node->children, node->children->num);
-    /* draw red ring for unselected nodes, green for selected */
+void pngBegin(PngWriter* png, int width, int height){
+    static unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    fwrite(signature, 1, 8, png->file);
+    unsigned char header[13] = {0};
+    putBigEndian(header, width);
+    putBigEndian(header + 4, height);
+    header[8] = 8;          // bits per sample
+    header[9] = 2;          // truecolor
+    pngChunk(png->file, "IHDR", header, 13);
+    png->adler_a = 1;
+    png->adler_b = 0;
+    pngBits(png, 0x78, 8);  // zlib header
+    pngBits(png, 0x01, 8);
+    pngBits(png, 1, 1);     // final block
+    pngBits(png, 1, 2);     // fixed huffman codes
+}
+
+void pngEnd(PngWriter* png){
+    pngFlushRun(png);
+    pngSymbol(png, 256);    // end of block
+    if ( png->num_bits ) pngBits(png, 0, 8 - png->num_bits);
+    unsigned long adler = (png->adler_b << 16) | png->adler_a;
+    for (int shift = 24; shift >= 0; shift -= 8)
+        pngBits(png, (adler >> shift) & 0xff, 8);
+    pngFlush(png);
+    pngChunk(png->file, "IEND", NULL, 0);
+}
+
+// graph coordinates covered by a node, its text and the edge up to its parent
+void nodeExtent(Node* node, int* x0, int* y0, int* x1, int* y1){
     int width  = getWidth(node->text.buf, true) * GRAPH_SCALE;
-    int height = getHeight(node->text.buf, true) * GRAPH_SCALE;
-    if ( is_visible(node) ){
-        if (node == CUT)
-            drawBorder(APP.renderer, x, y, width, height, THICKNESS, CUT_COLOR);
-        else if (node == GRAPH.selected)
-            drawBorder(APP.renderer, x, y, width, height, THICKNESS, SELECTED_COLOR);
-        else
-            drawBorder(APP.renderer, x, y, width, height, THICKNESS, UNSELECTED_COLOR);
+    int height = nodeTextHeight(node->text.buf) * GRAPH_SCALE;
+    *x0 = node->pos.x - width / 2 - THICKNESS;
+    *x1 = node->pos.x + width / 2 + THICKNESS;
+    *y0 = node->pos.y - height / 2 - THICKNESS;
+    *y1 = node->pos.y + height / 2 + THICKNESS + TEXTBOX_HEIGHT * GRAPH_SCALE;
+    if ( node != GRAPH.root ){
+        *x0 = min(*x0, node->p->pos.x);
+        *x1 = max(*x1, node->p->pos.x);
+        *y0 = min(*y0, node->p->pos.y);
     }
+}
 
-    /* draw edges between parent and child nodes */
-    if (node != GRAPH.root && (is_visible(node->p) || is_visible(node)) ){
-        SDL_SetRenderDrawColor(APP.renderer, EDGE_COLOR.r, EDGE_COLOR.g, EDGE_COLOR.b, 255);
-        SDL_RenderDrawLine(APP.renderer, x, y - (height*GRAPH_SCALE/2), node->p->pos.x, node->p->pos.y + (getHeight(node->p->text.buf, true) * GRAPH_SCALE / 2));
+void exportBounds(Node* node, int* bounds){
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); ) {
+        if ( !walk.pre ) continue;
+        int x0, y0, x1, y1;
+        nodeExtent(cur, &x0, &y0, &x1, &y1);
+        bounds[0] = min(bounds[0], x0);
+        bounds[1] = min(bounds[1], y0);
+        bounds[2] = max(bounds[2], x1);
+        bounds[3] = max(bounds[3], y1);
     }
+    walkEnd(&walk);
+}
 
-    if ( is_visible(node) ){
-        Point message_pos;
-        message_pos.x = x - (width / 2);
-        message_pos.y = y - (height / 2);
+int compareExportItems(const void* a, const void* b){
+    return ((ExportItem*) a)->x0 - ((ExportItem*) b)->x0;
+}
 
-        /* render node text */
-        renderMessage(node->text.buf, message_pos, GRAPH_SCALE, EDIT_COLOR, 1, &node->text == CURRENT_BUFFER);
-        char** lines = getLines(node->text.buf, true);
-        int cur_line = 0;
-        char* line = lines[cur_line];
-        while ( line ){
-            if ( *line ) free (line);
-            line = lines[++cur_line];
+int compareExportItemsByY(const void* a, const void* b){
+    return ((ExportItem*) a)->y0 - ((ExportItem*) b)->y0;
+}
 
-        }
-        free ( lines );
-        /* render hint text */
-        if ( isHintMode(MODE) && strlen(node->hint_text) > 0 ){
-            // dont render hint text that doesn't match hint buffer
-            bool render_hint = true;
-            if (HINT_BUFFER.len > 0){
-                for (int i = 0; i < HINT_BUFFER.len; ++i) {
-                    if ( HINT_BUFFER.buf[i] != node->hint_text[i] ){
-                        render_hint = false;
-                        break;
-                    }
-                }
+// collects every node of a subtree with its extent, sorted from top to bottom
+ExportItem* exportCollect(Node* node, int* num){
+    ExportItem* items = memMalloc(MemFiles, subtreeSize(node) * sizeof(ExportItem));
+    *num = 0;
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); ) {
+        if ( !walk.pre ) continue;
+        ExportItem* item = &items[(*num)++];
+        item->node = cur;
+        nodeExtent(cur, &item->x0, &item->y0, &item->x1, &item->y1);
+    }
+    walkEnd(&walk);
+    qsort(items, *num, sizeof(ExportItem), compareExportItemsByY);
+    return items;
+}
+
+bool exportPng(char* path, int* bounds){
+    int width  = bounds[2] - bounds[0];
+    int height = bounds[3] - bounds[1];
+    FILE* stage = tmpfile();
+    PngWriter* png = memCalloc(MemFiles, 1, sizeof(PngWriter));
+    png->file = fopen(path, "wb");
+    SDL_Surface* tile = SDL_CreateRGBSurfaceWithFormat(0, EXPORT_TILE_WIDTH, EXPORT_TILE_HEIGHT, 32, SDL_PIXELFORMAT_RGB888);
+    SDL_Renderer* renderer = tile ? SDL_CreateSoftwareRenderer(tile) : NULL;
+    unsigned char* pixels = memMalloc(MemFiles, EXPORT_TILE_WIDTH * EXPORT_TILE_HEIGHT * 3);
+    if ( !stage || !png->file || !renderer ){
+        fprintf(stderr, "Could not export to %s: %s\n", path, png->file ? SDL_GetError() : strerror(errno));
+        if ( stage ) fclose(stage);
+        if ( png->file ) fclose(png->file);
+        if ( renderer ) SDL_DestroyRenderer(renderer);
+        SDL_FreeSurface(tile);
+        memFree(MemFiles, pixels);
+        memFree(MemFiles, png);
+        return false;
+    }
+
+    // draw through the tile renderer as if it were a window of the tile's size
+    SDL_Renderer* window_renderer = APP.renderer;
+    Point window_size = APP.window_size;
+    minimapReset();
+    APP.renderer = renderer;
+    APP.window_size.x = EXPORT_TILE_WIDTH;
+    APP.window_size.y = EXPORT_TILE_HEIGHT;
+
+    pngBegin(png, width, height);
+    int num_nodes;
+    ExportItem* nodes = exportCollect(GRAPH.root, &num_nodes);
+    ExportItem* items = memMalloc(MemFiles, max(1, num_nodes) * sizeof(ExportItem));
+    ExportItem* active = memMalloc(MemFiles, max(1, num_nodes) * sizeof(ExportItem));
+    int next_node = 0, num_items = 0;
+    for (int strip_y = 0; strip_y < height; strip_y += EXPORT_TILE_HEIGHT) {
+        int strip_h = min(EXPORT_TILE_HEIGHT, height - strip_y);
+        int y0 = bounds[1] + strip_y, y1 = y0 + strip_h;
+        // keep the items that still reach into the strip, then add the ones that start in it
+        int kept = 0;
+        for (int i = 0; i < num_items; i++)
+            if ( items[i].y1 >= y0 ) items[kept++] = items[i];
+        num_items = kept;
+        for (; next_node < num_nodes && nodes[next_node].y0 < y1; next_node++)
+            if ( nodes[next_node].y1 >= y0 ) items[num_items++] = nodes[next_node];
+        qsort(items, num_items, sizeof(ExportItem), compareExportItems);
+
+        // sweep tiles left to right, keeping the items that overlap the current tile
+        int next_item = 0, num_active = 0;
+        for (int tile_x = 0; tile_x < width; tile_x += EXPORT_TILE_WIDTH) {
+            int tile_w = min(EXPORT_TILE_WIDTH, width - tile_x);
+            RENDER_ORIGIN.x = bounds[0] + tile_x;
+            RENDER_ORIGIN.y = bounds[1] + strip_y;
+            while ( next_item < num_items && items[next_item].x0 < RENDER_ORIGIN.x + tile_w )
+                active[num_active++] = items[next_item++];
+            int kept = 0;
+            for (int i = 0; i < num_active; i++)
+                if ( active[i].x1 >= RENDER_ORIGIN.x ) active[kept++] = active[i];
+            num_active = kept;
+
+            SDL_SetRenderDrawColor(renderer, BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b, 255);
+            SDL_RenderClear(renderer);
+            for (int i = 0; i < num_active; i++)
+                drawNodeItem(active[i].node, false);
+            SDL_Rect rect = {0, 0, tile_w, strip_h};
+            SDL_RenderReadPixels(renderer, &rect, SDL_PIXELFORMAT_RGB24, pixels, tile_w * 3);
+            for (int row = 0; row < strip_h; row++) {
+                fseeko(stage, ((off_t) row * width + tile_x) * 3, SEEK_SET);
+                fwrite(pixels + row * tile_w * 3, 3, tile_w, stage);
             }
-            // position char in top left of node
-            if ( render_hint ) {
-                message_pos.x = x - (int)(width/ 2) - THICKNESS;
-                message_pos.y = y  - (int)(height/ 2) - THICKNESS - (RADIUS * GRAPH_SCALE);
-                renderMessage(node->hint_text, message_pos, 0.75 * GRAPH_SCALE, HINT_COLOR, 0, 0);
+        }
+
+        // each scanline starts with filter type 0, then the staged pixels
+        fseeko(stage, 0, SEEK_SET);
+        for (int row = 0; row < strip_h; row++) {
+            unsigned char filter = 0;
+            pngWrite(png, &filter, 1);
+            for (size_t left = (size_t) width * 3; left > 0; ) {
+                size_t chunk = fread(pixels, 1, min(left, EXPORT_TILE_WIDTH * EXPORT_TILE_HEIGHT * 3), stage);
+                if ( !chunk ) break;
+                pngWrite(png, pixels, chunk);
+                left -= chunk;
             }
         }
     }
+    pngEnd(png);
+
+    RENDER_ORIGIN.x = RENDER_ORIGIN.y = 0;
+    APP.renderer = window_renderer;
+    APP.window_size = window_size;
+    bool written = !ferror(png->file) && !ferror(stage);
+    written = !fclose(png->file) && written;
+    fclose(stage);
+    memFree(MemFiles, nodes);
+    memFree(MemFiles, items);
+    memFree(MemFiles, active);
+    memFree(MemFiles, pixels);
+    memFree(MemFiles, png);
+    SDL_DestroyRenderer(renderer);
+    SDL_FreeSurface(tile);
+    return written;
+}
+
+void svgColor(FILE* file, SDL_Color color){
+    fprintf(file, "#%02x%02x%02x", color.r, color.g, color.b);
+}
+
+void svgText(FILE* file, char* text){
+    for (; *text; text++) {
+        switch ( *text ){
+            case '&': fputs("&amp;", file); break;
+            case '<': fputs("&lt;", file); break;
+            case '>': fputs("&gt;", file); break;
+            default: fputc(*text, file);
+        }
+    }
+}
 
-    for (int i=0; i<node->children->num; i++){
-        logPrint("Drawing child %d / %lu: %p...\n", i, node->children->num, node->children->array[i]);
-        drawNode(node->children->array[i]);
+// mirrors drawNodeItem: parent edge, border, then one text element per line
+void svgNode(FILE* file, Node* node, int* bounds){
+    Walk walk;
+    walkBegin(&walk, node);
+    for (Node* cur; (cur = walkNext(&walk)); ) {
+        if ( !walk.pre ) continue;
+        int x = cur->pos.x - bounds[0];
+        int y = cur->pos.y - bounds[1];
+        int width  = getWidth(cur->text.buf, true) * GRAPH_SCALE;
+        int height = nodeTextHeight(cur->text.buf) * GRAPH_SCALE;
+        if ( cur != GRAPH.root ){
+            fprintf(file, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" stroke=\"", x, (int) (y - height * GRAPH_SCALE / 2),
+                    cur->p->pos.x - bounds[0], (int) (cur->p->pos.y - bounds[1] + nodeTextHeight(cur->p->text.buf) * GRAPH_SCALE / 2));
+            svgColor(file, EDGE_COLOR);
+            fputs("\"/>\n", file);
+        }
+        double inset = (THICKNESS - 1) / 2.0;
+        fprintf(file, "<rect x=\"%g\" y=\"%g\" width=\"%g\" height=\"%g\" fill=\"none\" stroke-width=\"%d\" stroke=\"",
+                x - width / 2 - inset, y - height / 2 - inset, width + 2 * inset, height + 2 * inset, THICKNESS);
+        svgColor(file, nodeBorderColor(cur));
+        fputs("\"/>\n", file);
+
+        char** lines = getLines(cur->text.buf, true);
+        double line_height = TEXTBOX_HEIGHT * GRAPH_SCALE;
+        for (int i = 0; lines[i] && i < MAX_NODE_LINES; i++) {
+            if ( !*lines[i] ) continue;
+            fprintf(file, "<text x=\"%d\" y=\"%g\" font-size=\"%g\" textLength=\"%g\" lengthAdjust=\"spacingAndGlyphs\" fill=\"",
+                    x - width / 2, y - height / 2 + line_height * (i + 0.8), line_height, strlen(lines[i]) * TEXTBOX_WIDTH_SCALE * GRAPH_SCALE);
+            svgColor(file, EDIT_COLOR);
+            fputs("\">", file);
+            svgText(file, lines[i]);
+            fputs("</text>\n", file);
+        }
+        freeLines(lines);
+        if ( cur->lazy_next >= 0 ){
+            fprintf(file, "<text x=\"%d\" y=\"%g\" font-size=\"%g\" fill=\"", x - width / 2,
+                    y + height / 2 + THICKNESS + line_height * 0.4, line_height / 2);
+            svgColor(file, EDGE_COLOR);
+            fprintf(file, "\">+%lld</text>\n", cur->lazy_end - cur->lazy_next + 1);
+        }
+        int hidden = getHeight(cur->text.buf, true) / TEXTBOX_HEIGHT - MAX_NODE_LINES;
+        if ( hidden > 0 ){
+            fprintf(file, "<text x=\"%d\" y=\"%g\" font-size=\"%g\" text-anchor=\"end\" fill=\"", x + width / 2,
+                    y + height / 2 + THICKNESS + line_height * 0.4, line_height / 2);
+            svgColor(file, EDGE_COLOR);
+            fprintf(file, "\">+%d lines</text>\n", hidden);
+        }
     }
-    logPrint("Finished drawing %p\n", node);
+    walkEnd(&walk);
 }
 
-/* re-computes graph and draws everything onto renderer */
-void prepareScene() {
-    logPrint("start prepareScene()\n");
-    SDL_SetRenderDrawColor(APP.renderer, BACKGROUND_COLOR.r, BACKGROUND_COLOR.g, BACKGROUND_COLOR.b, 255); /* Background color */
-    SDL_RenderClear(APP.renderer);
+bool exportSvg(char* path, int* bounds){
+    FILE* file = fopen(path, "w");
+    if ( !file ){
+        fprintf(stderr, "Could not export to %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    int width  = bounds[2] - bounds[0];
+    int height = bounds[3] - bounds[1];
+    fprintf(file, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" font-family=\"monospace\">\n", width, height);
+    fprintf(file, "<rect width=\"100%%\" height=\"100%%\" fill=\"");
+    svgColor(file, BACKGROUND_COLOR);
+    fputs("\"/>\n", file);
+    svgNode(file, GRAPH.root, bounds);
+    fputs("</svg>\n", file);
+    bool written = !ferror(file);
+    return !fclose(file) && written;
+}
 
-    logPrint("Rendered\n");
-    // recompute the coordinates of each node in the tree
+// Exports next to the current file, e.g. notes.txt -> notes.txt.png
+void exportCurrentTree(char* extension){
+    if ( REPLAYING ) return;
+    char path[FILENAME_MAX + 16];
+    snprintf(path, sizeof(path), "%s%s", FILENAME_BUFFER.buf, extension);
+    exportTree(path);
+}
+
+// Exports the whole tree as PNG, or as SVG if path ends in .svg
+bool exportTree(char* path){
+    layoutSync(GRAPH.root);
     calculatePositions(GRAPH.root, GRAPH.selected);
-    logPrint("calculatePositions\n");
+    int bounds[4] = {GRAPH.root->pos.x, GRAPH.root->pos.y, GRAPH.root->pos.x, GRAPH.root->pos.y};
+    exportBounds(GRAPH.root, bounds);
+    bounds[0] -= RADIUS; bounds[1] -= RADIUS;
+    bounds[2] += RADIUS; bounds[3] += RADIUS;
+
+    size_t len = strlen(path);
+    bool svg = len >= 4 && strcasecmp(path + len - 4, ".svg") == 0;
+    bool written = svg ? exportSvg(path, bounds) : exportPng(path, bounds);
+    if ( written )
+        fprintf(stderr, "Exported %dx%d image to %s\n", bounds[2] - bounds[0], bounds[3] - bounds[1], path);
+    return written;
+}
 
-    // Draw Graph
-    drawNode(GRAPH.root);
-    logPrint("drawNode\n");
 
-    // Draw filename
-    Point filename_pos;
-    filename_pos.x = (int) ((0.0) * APP.window_size.x);
-    filename_pos.y = (int) ((1.0) * APP.window_size.y - (TEXTBOX_HEIGHT * UI_SCALE));
+// BATCH QUERIES
+
+/* dtree file.txt --query <command> answers questions about a file without opening a
+ * window. count, stats, grep and subtree stream the file through a Loader with a Query
+ * attached instead of building the tree, so they need memory only for the open levels:
+ *     count                  number of nodes
+ *     stats                  node, leaf, depth, width and text totals
+ *     grep <regex>           path and text of every node matching an extended regex
+ *     subtree <path>         the subtree at path, in the native format
+ *     reparent <path> <new>  the whole file, with the subtree at path moved under new
+ * reparent has to load the tree, and writes it in the format it was read in. Paths are
+ * child indices from the root as in the journal, "." for the root and ".0.2" for the third
+ * child of its first child. Results go to stdout, errors to stderr. */
+enum QueryCommand{QueryCount, QueryStats, QueryGrep, QuerySubtree, QueryReparent};
+
+struct Query {
+    enum QueryCommand command;
+    int depth;              // levels of the current path
+    int levels;             // size of children and widths
+    int height;             // deepest level seen
+    size_t* children;       // children seen so far of the node on the level above
+    size_t* widths;         // nodes on each level
+    size_t nodes, parents, matches, text_bytes, max_children, depth_sum;
+    regex_t pattern;        // grep
+    int* target;            // subtree: child indices of the path
+    int target_len;
+    int matched;            // levels of the current path that are on the target path
+    Saver saver;
+};
 
-    char FILENAME_MESSAGE[2048];
-    strcpy(FILENAME_MESSAGE, FILENAME_BUFFER.buf);
-    if ( unwritten ){
-        strcpy( FILENAME_MESSAGE + FILENAME_BUFFER.len, "*");
+static char* QUERY_COMMANDS[] = {"count", "stats", "grep", "subtree", "reparent"};
+static int QUERY_ARGS[] = {0, 0, 1, 1, 2};
+
+// parses a path like ".0.2" into child indices, returns the number of them or -1
+static int queryParsePath(char* path, int** indices){
+    if ( *path != '.' ) return -1;
+    int num = 0;
+    *indices = memMalloc(MemOther, (strlen(path) / 2 + 1) * sizeof(int));
+    for (char* c = path + 1; *c; ) {
+        if ( !isdigit((unsigned char) *c) ){
+            memFree(MemOther, *indices);
+            return -1;
+        }
+        (*indices)[num++] = strtol(c, &c, 10);
+        if ( *c == '.' ) c++;
     }
-    renderMessage(FILENAME_MESSAGE, filename_pos, UI_SCALE, EDIT_COLOR, 0, &FILENAME_BUFFER == CURRENT_BUFFER);
+    return num;
+}
 
+static void queryPrintPath(Query* query, int level){
+    if ( level == 0 ) putchar('.');
+    for (int i = 1; i <= level; i++)
+        printf(".%zu", query->children[i] - 1);
+}
 
-    // Draw mode
-    Point mode_text_pos;
-    mode_text_pos.x = (int) ((0.0) * APP.window_size.x);
-    mode_text_pos.y = (int) ((0.0) * APP.window_size.y);
-    renderMessage(getModeName(MODE), mode_text_pos, UI_SCALE, EDIT_COLOR, 0, 0);
+// sees one node of the file being streamed, level is clamped as loaderAdd does
+void queryNode(Query* query, int level, char* text){
+    level = query->depth ? max(1, min(level, query->depth)) : 0;
+    if ( level + 2 > query->levels ){
+        int old = query->levels;
+        query->levels = 2 * (level + 2);
+        query->children = memRealloc(MemOther, query->children, query->levels * sizeof(size_t));
+        query->widths = memRealloc(MemOther, query->widths, query->levels * sizeof(size_t));
+        for (int i = old; i < query->levels; i++)
+            query->widths[i] = 0;
+    }
+    if ( level > 0 && ++query->children[level] == 1 )
+        query->parents++;
+    if ( level > 0 && query->children[level] > query->max_children )
+        query->max_children = query->children[level];
+    query->children[level + 1] = 0;
+    query->widths[level]++;
+    query->depth = level + 1;
+    query->height = max(query->height, level);
+    query->nodes++;
+    query->depth_sum += level;
+    query->text_bytes += strlen(text);
+    switch ( query->command ){
+        case QueryGrep:
+            if ( regexec(&query->pattern, text, 0, NULL, 0) != 0 ) break;
+            query->matches++;
+            queryPrintPath(query, level);
+            putchar('\t');
+            for (char* c = text; *c; c++)
+                putchar(*c == '\n' ? '|' : *c);
+            putchar('\n');
+            break;
+        case QuerySubtree:
+            // the path above this node is unchanged, so only its own index can extend the match
+            query->matched = min(query->matched, max(level - 1, 0));
+            if ( level > 0 && query->matched == level - 1 && level <= query->target_len
+                 && query->children[level] - 1 == query->target[level - 1] )
+                query->matched = level;
+            if ( query->matched == query->target_len && level >= query->target_len ){
+                query->matches++;
+                saverNode(&query->saver, level - query->target_len, text);
+            }
+            break;
+        default:
+            break;
+    }
+}
 
-    //Draw hint buffer
-    Point hint_buf_pos;
-    hint_buf_pos.x = (int) ((1.0 * APP.window_size.x) - (HINT_BUFFER.len * TEXTBOX_WIDTH_SCALE * UI_SCALE));
-    hint_buf_pos.y = (int) ((1.0) * APP.window_size.y - (TEXTBOX_HEIGHT * UI_SCALE));
-    renderMessage(HINT_BUFFER.buf, hint_buf_pos, UI_SCALE, HINT_COLOR, 0, 0);
+static void queryStats(Query* query){
+    int widest = 0;
+    for (int i = 1; i <= query->height; i++)
+        if ( query->widths[i] > query->widths[widest] ) widest = i;
+    printf("%-14s %zu\n", "nodes", query->nodes);
+    printf("%-14s %zu\n", "leaves", query->nodes - query->parents);
+    printf("%-14s %d\n", "depth", query->height);
+    printf("%-14s %.2f\n", "mean depth", query->nodes ? (double) query->depth_sum / query->nodes : 0);
+    printf("%-14s %zu nodes on level %d\n", "widest level", query->nodes ? query->widths[widest] : 0, widest);
+    printf("%-14s %zu\n", "most children", query->max_children);
+    printf("%-14s %zu\n", "text bytes", query->text_bytes);
+}
 
-    if ( TOGGLE_MODE ){
-        Point toggle_indicator_pos;
-        toggle_indicator_pos.x = (int) ((1.0 * APP.window_size.x) - (strlen(TOGGLE_INDICATOR) * TEXTBOX_WIDTH_SCALE * UI_SCALE));
-        toggle_indicator_pos.y = (int) ((0.0) * APP.window_size.y);
-        renderMessage(TOGGLE_INDICATOR, toggle_indicator_pos, 1.0, EDIT_COLOR, 0, 0);
+// moves the subtree at from under the node at to and writes the whole tree out
+static bool queryReparent(char* from, char* to){
+    FILE* fp = fopen(FILENAME_BUFFER.buf, "r");
+    if ( !fp ){
+        fprintf(stderr, "Could not open %s: %s\n", FILENAME_BUFFER.buf, strerror(errno));
+        return false;
+    }
+    makeGraph(&GRAPH);
+    Loader loader;
+    loaderBegin(&loader, GRAPH.root, NULL);
+    importOutline(fp, outlineFormat(FILENAME_BUFFER.buf), &loader, NULL);
+    loaderEnd(&loader);
+    fclose(fp);
+    Node* node = journalResolve(&from);
+    Node* parent = journalResolve(&to);
+    if ( !node || *from || !parent || *to ){
+        fprintf(stderr, "No node at %s\n", !node || *from ? from : to);
+        return false;
+    }
+    if ( node == GRAPH.root || isInSubtree(parent, node) ){
+        fprintf(stderr, "Cannot move a node under itself\n");
+        return false;
     }
+    moveNode(node, parent, -1);
+    saveTree(stdout, outlineFormat(FILENAME_BUFFER.buf));
+    return !ferror(stdout);
 }
 
-/* actually renders the screen */
-void presentScene() {
-    SDL_RenderPresent(APP.renderer);
+// runs the query in argv against FILENAME_BUFFER, returns the exit status
+int runQuery(int argc, char** argv){
+    Query query;
+    memset(&query, 0, sizeof(query));
+    int command = 0;
+    while ( command <= QueryReparent && strcmp(argv[0], QUERY_COMMANDS[command]) != 0 )
+        command++;
+    if ( command > QueryReparent || argc - 1 < QUERY_ARGS[command] ){
+        fprintf(stderr, "Usage: dtree <file> --query count | stats | grep <regex> | subtree <path> | reparent <path> <new parent>\n");
+        return 2;
+    }
+    query.command = command;
+    if ( command == QueryReparent )
+        return !queryReparent(argv[1], argv[2]);
+    if ( command == QueryGrep && regcomp(&query.pattern, argv[1], REG_EXTENDED | REG_NOSUB) != 0 ){
+        fprintf(stderr, "Invalid pattern %s\n", argv[1]);
+        return 2;
+    }
+    if ( command == QuerySubtree && (query.target_len = queryParsePath(argv[1], &query.target)) < 0 ){
+        fprintf(stderr, "Invalid path %s\n", argv[1]);
+        return 2;
+    }
+    FILE* fp = fopen(FILENAME_BUFFER.buf, "r");
+    if ( !fp ){
+        fprintf(stderr, "Could not open %s: %s\n", FILENAME_BUFFER.buf, strerror(errno));
+        return 1;
+    }
+    saverBegin(&query.saver, stdout, Native);
+    Loader loader;
+    loaderBegin(&loader, NULL, NULL);
+    loader.query = &query;
+    bool read = importOutline(fp, outlineFormat(FILENAME_BUFFER.buf), &loader, NULL);
+    loaderEnd(&loader);
+    saverEnd(&query.saver);
+    fclose(fp);
+
+    int status = read ? 0 : 1;
+    switch ( query.command ){
+        case QueryCount: printf("%zu\n", query.nodes); break;
+        case QueryStats: queryStats(&query); break;
+        case QueryGrep: regfree(&query.pattern); status = status || !query.matches; break;
+        case QuerySubtree:
+            if ( !query.matches ) fprintf(stderr, "No node at %s\n", argv[1]);
+            memFree(MemOther, query.target);
+            status = status || !query.matches;
+            break;
+        default: break;
+    }
+    memFree(MemOther, query.children);
+    memFree(MemOther, query.widths);
+    return status;
 }
 
 
 // INITIALIZATION AND MAIN
 
-void initSDL() {
-    HINT_NODES = initArray(10);
+// headless runs only render offscreen, so they need neither a display nor a window
+void initSDL(bool headless) {
+    HINT_NODES = initTaggedArray(10, MemHints);
     logPrint("%p\n", HINT_NODES->array);
     logPrint("%ld\n", HINT_NODES->num);
+    if ( headless ){
+        if (SDL_Init(0) < 0) {
+            printf("Couldn't initialize SDL: %s\n", SDL_GetError());
+            exit(1);
+        }
+        APP.window_size.x = SCREEN_WIDTH;
+        APP.window_size.y = SCREEN_HEIGHT;
+    }
+    else
+        initWindow();
+
+    /* start SDL_ttf */
+    if(TTF_Init()==-1){
+        logPrint("TTF_Init: %s\n", TTF_GetError());
+        return;
+    }
+    atexit(TTF_Quit); /* remember to quit SDL_ttf */
+    FONT = TTF_OpenFont(FONT_NAME, FONT_SIZE);
+}
+
+void initWindow() {
     int renderer_flags, window_flags;
     renderer_flags = SDL_RENDERER_ACCELERATED;
     window_flags = SDL_WINDOW_RESIZABLE;
@@ -1226,53 +5912,145 @@ void initSDL() {
     }
     APP.quit = false;
     SDL_GetWindowSize(APP.window, &APP.window_size.x, &APP.window_size.y);
-
-    /* start SDL_ttf */
-    if(TTF_Init()==-1){
-        logPrint("TTF_Init: %s\n", TTF_GetError());
-        return;
-    }
-    atexit(TTF_Quit); /* remember to quit SDL_ttf */
-    FONT = TTF_OpenFont(FONT_NAME, FONT_SIZE);
 }
 
 int main(int argc, char *argv[]) {
     /* set all bytes of App memory to zero */
     memset(&APP, 0, sizeof(App));
+
+    FILENAME_BUFFER.buf = memCalloc(MemOther, FILENAME_BUFFER.size, sizeof(char));
+    strcpy(FILENAME_BUFFER.buf, "unnamed.txt");
+    char* export_path = NULL;
+    char* convert_path = NULL;
+    char* record_path = NULL;
+    char* replay_path = NULL;
+    bool memory_report = false;
+    char** query_argv = NULL;
+    int query_argc = 0;
+    for (int i = 1; i < argc; i++) {
+        if ( strcmp(argv[i], "-j") == 0 )
+            JOURNAL_MODE = true;
+        else if ( strcmp(argv[i], "-l") == 0 )
+            LAZY_MODE = true;
+        else if ( strcmp(argv[i], "--export") == 0 && i + 1 < argc )
+            export_path = argv[++i];
+        else if ( strcmp(argv[i], "--memory") == 0 )
+            memory_report = true;
+        else if ( strcmp(argv[i], "--convert") == 0 && i + 1 < argc )
+            convert_path = argv[++i];
+        else if ( strcmp(argv[i], "--record") == 0 && i + 1 < argc )
+            record_path = argv[++i];
+        else if ( strcmp(argv[i], "--replay") == 0 && i + 1 < argc )
+            replay_path = argv[++i];
+        // everything after --query belongs to the query
+        else if ( strcmp(argv[i], "--query") == 0 && i + 1 < argc ){
+            query_argv = argv + i + 1;
+            query_argc = argc - i - 1;
+            break;
+        }
+        else
+            strncpy(FILENAME_BUFFER.buf, argv[i], FILENAME_BUFFER.size - 1);
+    }
+    if ( convert_path ){
+        bool converted = convertOutline(FILENAME_BUFFER.buf, convert_path);
+        memFree(MemOther, FILENAME_BUFFER.buf);
+        return !converted;
+    }
+    if ( query_argv ){
+        int status = runQuery(query_argc, query_argv);
+        memFree(MemOther, FILENAME_BUFFER.buf);
+        return status;
+    }
+    // the journal and the lazy index address lines of the native format
+    if ( (JOURNAL_MODE || LAZY_MODE) && outlineFormat(FILENAME_BUFFER.buf) != Native ){
+        fprintf(stderr, "-j and -l only apply to the native format, opening normally\n");
+        JOURNAL_MODE = LAZY_MODE = false;
+    }
+    // a replay must leave the document as it found it
+    if ( replay_path && JOURNAL_MODE ){
+        fprintf(stderr, "-j does not apply to --replay, opening normally\n");
+        JOURNAL_MODE = false;
+    }
+
     /* set up window, screen, and renderer */
-    initSDL();
+    initSDL(export_path || memory_report || replay_path);
 
     makeGraph(&GRAPH);
 
-    FILENAME_BUFFER.buf = calloc(FILENAME_BUFFER.size, sizeof(char));
-    if ( argc > 1 )
-        strcpy(FILENAME_BUFFER.buf, argv[1]);
-    else
-        strcpy(FILENAME_BUFFER.buf, "unnamed.txt");
-
 
-    HINT_TEXT_QUEUE = calloc(8192, sizeof(char*));
+    HINT_TEXT_QUEUE = memCalloc(MemHints, 8192, sizeof(char*));
     for (int i = 0; i < 8192; ++i)
-        HINT_TEXT_QUEUE[i] = calloc(HINT_BUFFER.size + 1, sizeof(char));
+        HINT_TEXT_QUEUE[i] = memCalloc(MemHints, HINT_BUFFER.size + 1, sizeof(char));
 
 
     FILENAME_BUFFER.len = strlen(FILENAME_BUFFER.buf);
-    HINT_BUFFER.buf = calloc(HINT_BUFFER.size + 1, sizeof(char));
-
-    readFile();
+    HINT_BUFFER.buf = memCalloc(MemOther, HINT_BUFFER.size + 1, sizeof(char));
+    SEARCH_BUFFER.buf = memCalloc(MemOther, SEARCH_BUFFER.size + 1, sizeof(char));
+    SEARCH_RESULTS = initTaggedArray(SEARCH_MAX_RESULTS, MemSearch);
+    MARKED = initArray(16);
+
+    // journal records address nodes by path, which needs the whole tree loaded
+    if ( JOURNAL_MODE )
+        journalLoad();
+    else if ( LAZY_MODE )
+        lazyOpen();
+    else
+        readFile();
+    // the layout cache is keyed by the file as read, before the journal or lazy loading change the tree
+    bool layout_cached = !JOURNAL_MODE && !LAZY_MODE && layoutCacheLoad();
     calculatePositions(GRAPH.root,GRAPH.selected);
+    if ( !JOURNAL_MODE && !LAZY_MODE && !layout_cached )
+        layoutCacheSave();
     switchMode(Travel);
+    // the journal and the lazy index address the file by line, so it may not change under them
+    if ( !export_path && !memory_report && !replay_path && !JOURNAL_MODE && !LAZY_MODE )
+        reloadWatch();
+    if ( !export_path && !memory_report && !replay_path )
+        layoutAsyncBegin();
     /* gracefully close windows on exit of program */
     atexit(SDL_Quit);
     APP.quit = false;
 
+    int exit_status = 0;
+    if ( export_path ){
+        exit_status = !exportTree(export_path);
+        APP.quit = true;
+    }
+    if ( memory_report ){
+        memReport(stdout);
+        APP.quit = true;
+    }
+    if ( replay_path ){
+        exit_status = !replayEvents(replay_path);
+        APP.quit = true;
+    }
+    else if ( record_path && !APP.quit && !recordBegin(record_path) )
+        APP.quit = true;
+
     SDL_Event e;
-    /* Only updates display and processes inputs on new events */
-    while ( !APP.quit && SDL_WaitEvent(&e) ) {
-        if ( e.type == SDL_MOUSEMOTION) continue;
-        /* Handle input before rendering */
-        eventHandler(&e);
+    /* Only updates display and processes inputs on new events,
+     * or periodically while the status of an open is on screen */
+    while ( !APP.quit ) {
+        if ( openJobsShown() ){
+            if ( SDL_WaitEventTimeout(&e, OPEN_POLL_MS) ){
+                if ( e.type == SDL_MOUSEMOTION) continue;
+                recordEvent(&e);
+                latencyInput(&e);
+                eventHandler(&e);
+            }
+            reapOpenJobs();
+        }
+        else {
+            if ( !SDL_WaitEvent(&e) ) break;
+            if ( e.type == SDL_MOUSEMOTION) continue;
+            /* Handle input before rendering */
+            recordEvent(&e);
+            latencyInput(&e);
+            eventHandler(&e);
+        }
         logPrint("Event handler done\n");
+        journalMaybeCompact();
+        reloadMaybeApply();
 
         logPrint("Prepare scene start...\n");
         prepareScene();
@@ -1286,18 +6064,26 @@ int main(int argc, char *argv[]) {
     }
 
 
+    recordEnd();
+    reloadClose();
+    layoutClose();
+    journalClose();
+    lazyClose();
     for (int i = 0; i < 8192; ++i)
-        free ( HINT_TEXT_QUEUE[i] );
-    free( HINT_TEXT_QUEUE );
+        memFree(MemHints, HINT_TEXT_QUEUE[i]);
+    memFree(MemHints, HINT_TEXT_QUEUE);
     HINT_NODES = freeArray ( HINT_NODES );
+    MARKED = freeArray ( MARKED );
 
-    if (HINT_BUFFER.buf) free(HINT_BUFFER.buf);
-    free(FILENAME_BUFFER.buf);
+    if (HINT_BUFFER.buf) memFree(MemOther, HINT_BUFFER.buf);
+    memFree(MemOther, SEARCH_BUFFER.buf);
+    memFree(MemOther, FILENAME_BUFFER.buf);
     /* delete nodes recursively, starting from root */
     removeNodeFromGraph(GRAPH.root);
     logPrint("Deleted all nodes\n");
-    SDL_DestroyRenderer( APP.renderer );
-    SDL_DestroyWindow( APP.window );
+    minimapReset();
+    if ( APP.renderer ) SDL_DestroyRenderer( APP.renderer );
+    if ( APP.window ) SDL_DestroyWindow( APP.window );
     SDL_Quit();
-    return 0;
+    return exit_status;
 }